@@ -0,0 +1,75 @@
+#include "Cache.h"
+
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Return the result stored for the key, or nullptr if there is none
+// or it was stored with different generations, in which case it is discarded
+const string* Result_cache::find(const string& key, const Cache_generations& generations)
+{
+    auto index_it = index.find(key);
+    if (index_it == index.end())
+    {
+        ++misses;
+        return nullptr;
+    }
+    Entry_list::iterator entry_it = index_it->second;
+    if (entry_it->generations != generations)
+    {
+        ++stale;
+        ++misses;
+        erase(entry_it);
+        return nullptr;
+    }
+    ++hits;
+    entries.splice(entries.begin(), entries, entry_it);
+    return &entry_it->result;
+}
+
+// Store a result for the key, replacing any result already there and
+// evicting the least recently used results to stay within the limits.
+// A result too big to fit is not stored.
+void Result_cache::insert(const string& key, const Cache_generations& generations, string result)
+{
+    auto index_it = index.find(key);
+    if (index_it != index.end())
+    {
+        erase(index_it->second);
+    }
+    size_t entry_bytes = key.size() + result.size();
+    if (entry_bytes > max_bytes || max_entries == 0)
+    {
+        return;
+    }
+    while (entries.size() >= max_entries || bytes + entry_bytes > max_bytes)
+    {
+        ++evictions;
+        erase(prev(entries.end()));
+    }
+    entries.push_front(Entry{key, generations, move(result)});
+    index[key] = entries.begin();
+    bytes += entry_bytes;
+}
+
+// Discard all the results
+void Result_cache::clear()
+{
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+// Remove a result from the cache
+void Result_cache::erase(Entry_list::iterator entry_it)
+{
+    bytes -= entry_it->key.size() + entry_it->result.size();
+    index.erase(entry_it->key);
+    entries.erase(entry_it);
+}
@@ -0,0 +1,73 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstddef>
+#include <utility>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/*
+A Result_cache keeps the formatted output of recent read-only commands, keyed by the command
+and its arguments, so that a repeated command can print its earlier output instead of
+computing it again. Each result is stored with the generations of the data it was computed
+from: counters that are bumped whenever that data changes and never go back, so a result
+is up to date exactly when the data's generations still match. Out-of-date results are
+discarded when they are looked up. The cache holds a limited number of results and bytes,
+and evicts the least recently used results to stay within those limits.
+*/
+
+// The generations of the data a result depends on
+typedef std::pair<unsigned long long, unsigned long long> Cache_generations;
+
+class Result_cache {
+public:
+    Result_cache(std::size_t max_entries_, std::size_t max_bytes_) :
+        max_entries{max_entries_}, max_bytes{max_bytes_} {}
+
+    // Return the result stored for the key, or nullptr if there is none
+    // or it was stored with different generations, in which case it is discarded
+    const std::string* find(const std::string& key, const Cache_generations& generations);
+    // Store a result for the key, replacing any result already there and
+    // evicting the least recently used results to stay within the limits.
+    // A result too big to fit is not stored.
+    void insert(const std::string& key, const Cache_generations& generations, std::string result);
+    // Discard all the results
+    void clear();
+
+    // The number of results and bytes held, and counts of lookups and discarded results
+    std::size_t size() const
+        { return entries.size(); }
+    std::size_t get_bytes() const
+        { return bytes; }
+    unsigned long long get_hits() const
+        { return hits; }
+    unsigned long long get_misses() const
+        { return misses; }
+    unsigned long long get_stale() const
+        { return stale; }
+    unsigned long long get_evictions() const
+        { return evictions; }
+
+private:
+    struct Entry {
+        std::string key;
+        Cache_generations generations;
+        std::string result;
+    };
+    typedef std::list<Entry> Entry_list;
+
+    std::size_t max_entries;
+    std::size_t max_bytes;
+    // the results, most recently used first, and where to find each key in the list
+    Entry_list entries;
+    std::unordered_map<std::string, Entry_list::iterator> index;
+    std::size_t bytes = 0;
+    unsigned long long hits = 0, misses = 0, stale = 0, evictions = 0;
+
+    // Remove a result from the cache
+    void erase(Entry_list::iterator entry_it);
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "Capture.h"
+
+#include <cstddef>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <chrono>
+#include <limits>
+
+#include <string>
+
+#include "Utility.h"
+
+using namespace std;
+
+const char * TRACE_MAGIC = "P3TRACE";
+const int TRACE_VERSION = 1;
+const char * TRACE_ERROR_MSG = "Invalid trace file!";
+
+// Write the header that starts a trace file
+void write_trace_header(ostream& os)
+{
+    os << TRACE_MAGIC << " " << TRACE_VERSION << "\n";
+}
+
+// Read and check the header of a trace file, throw Error exception if it is invalid
+void read_trace_header(istream& is)
+{
+    string magic;
+    int version;
+    if (!(is >> magic >> version) || magic != TRACE_MAGIC || version != TRACE_VERSION || is.get() != '\n')
+    {
+        throw Error(TRACE_ERROR_MSG);
+    }
+}
+
+// Write one entry to a trace file
+void write_trace_entry(ostream& os, const Trace_entry& entry)
+{
+    os << entry.arrival_us << " " << entry.exec_us << " " << static_cast<char>(entry.result) << " "
+        << entry.input.size() << " " << entry.lookahead << " " << entry.output.size() << "\n";
+    os.write(entry.input.data(), entry.input.size());
+    os.write(entry.output.data(), entry.output.size());
+}
+
+// Read the next entry of a trace file; return false at the end of the trace.
+// Throw Error exception if the entry is invalid.
+bool read_trace_entry(istream& is, Trace_entry& entry)
+{
+    char result;
+    size_t input_size, output_size;
+    if (!(is >> entry.arrival_us))
+    {
+        if (is.eof())
+        {
+            return false;
+        }
+        throw Error(TRACE_ERROR_MSG);
+    }
+    if (!(is >> entry.exec_us >> result >> input_size >> entry.lookahead >> output_size) || is.get() != '\n')
+    {
+        throw Error(TRACE_ERROR_MSG);
+    }
+    switch (result)
+    {
+        case static_cast<char>(Result_class::OK):
+        case static_cast<char>(Result_class::ERROR):
+        case static_cast<char>(Result_class::ERROR_NO_CLEAR):
+        case static_cast<char>(Result_class::QUIT):
+            entry.result = static_cast<Result_class>(result);
+            break;
+        default:
+            throw Error(TRACE_ERROR_MSG);
+    }
+    entry.input.resize(input_size);
+    entry.output.resize(output_size);
+    if (!is.read(&entry.input[0], input_size) || !is.read(&entry.output[0], output_size))
+    {
+        throw Error(TRACE_ERROR_MSG);
+    }
+    return true;
+}
+
+// Return and forget everything recorded so far
+string Recording_istreambuf::take_recording()
+{
+    string taken;
+    taken.swap(recording);
+    return taken;
+}
+
+Recording_istreambuf::int_type Recording_istreambuf::underflow()
+{
+    int_type c = source->sgetc();
+    peek_pending = !traits_type::eq_int_type(c, traits_type::eof());
+    return c;
+}
+
+Recording_istreambuf::int_type Recording_istreambuf::uflow()
+{
+    int_type c = source->sbumpc();
+    peek_pending = false;
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        recording.push_back(traits_type::to_char_type(c));
+    }
+    return c;
+}
+
+// Return and forget everything recorded so far
+string Recording_ostreambuf::take_recording()
+{
+    string taken;
+    taken.swap(recording);
+    return taken;
+}
+
+Recording_ostreambuf::int_type Recording_ostreambuf::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        return traits_type::not_eof(c);
+    }
+    recording.push_back(traits_type::to_char_type(c));
+    return destination->sputc(traits_type::to_char_type(c));
+}
+
+streamsize Recording_ostreambuf::xsputn(const char* s, streamsize n)
+{
+    recording.append(s, n);
+    return destination->sputn(s, n);
+}
+
+int Recording_ostreambuf::sync()
+{
+    return destination->pubsync();
+}
+
+// Start capturing the two streams into the trace file.
+// Throw Error exception if the trace file cannot be opened.
+Capture_session::Capture_session(istream& in_, ostream& out_, const string& filename) :
+    in(in_), out(out_), in_original{in_.rdbuf()}, out_original{out_.rdbuf()},
+    in_recorder{in_original}, out_recorder{out_original}, trace(filename.c_str(), ios::binary),
+    start{Clock::now()}, arrival{start}
+{
+    if (!trace)
+    {
+        throw Error("Could not open trace file!");
+    }
+    write_trace_header(trace);
+    in.rdbuf(&in_recorder);
+    out.rdbuf(&out_recorder);
+}
+
+// Stop capturing and restore the streams' own buffers
+Capture_session::~Capture_session()
+{
+    out.flush();
+    in.rdbuf(in_original);
+    out.rdbuf(out_original);
+}
+
+// Mark the start of a command, after its prompt has been written
+void Capture_session::begin_command()
+{
+    out.flush();
+    in_recorder.take_recording();
+    out_recorder.take_recording();
+    arrived = false;
+}
+
+// Note that the command's input has arrived and it is about to execute
+void Capture_session::command_arrived()
+{
+    arrival = Clock::now();
+    arrived = true;
+}
+
+// Mark the end of a command and write its trace entry
+void Capture_session::end_command(Result_class result)
+{
+    out.flush();
+    Clock::time_point end = Clock::now();
+    Trace_entry entry;
+    entry.arrival_us = microseconds_since(start, arrived ? arrival : end);
+    entry.exec_us = arrived ? microseconds_since(arrival, end) : 0;
+    entry.result = result;
+    entry.lookahead = in_recorder.peeked() ? 1 : 0;
+    entry.input = in_recorder.take_recording();
+    entry.output = out_recorder.take_recording();
+    write_trace_entry(trace, entry);
+    trace.flush();
+}
+
+long long Capture_session::microseconds_since(Clock::time_point from, Clock::time_point to) const
+{
+    return chrono::duration_cast<chrono::microseconds>(to - from).count();
+}
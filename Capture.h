@@ -0,0 +1,134 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstddef>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <chrono>
+
+#include <string>
+
+/*
+Workload capture records every command processed by the program into a trace file,
+so that a production command stream can be replayed later against a fresh process.
+Each trace entry holds the exact input consumed by one command, the output it produced,
+when it arrived, how long it took to execute, and how it finished.
+
+A trace file starts with the line "P3TRACE 1". Each entry is then a header line
+    <arrival_us> <exec_us> <result> <input_size> <lookahead> <output_size>
+followed immediately by input_size bytes of input and output_size bytes of output.
+Arrival times are in microseconds since capture started. lookahead is the number of bytes
+of the following entry's input that the command had to peek at before it could finish,
+such as the character after an integer, which a replayer must send along with this entry.
+*/
+
+// How a command finished
+enum class Result_class : char {
+    OK = 'o',               // completed normally
+    ERROR = 'e',            // reported an error and cleared the rest of the line
+    ERROR_NO_CLEAR = 'n',   // reported an error without clearing the line
+    QUIT = 'q'              // ended the program
+};
+
+// One command in a trace
+struct Trace_entry {
+    long long arrival_us = 0;
+    long long exec_us = 0;
+    Result_class result = Result_class::OK;
+    std::size_t lookahead = 0;
+    std::string input;
+    std::string output;
+};
+
+// Write the header that starts a trace file
+void write_trace_header(std::ostream& os);
+// Read and check the header of a trace file, throw Error exception if it is invalid
+void read_trace_header(std::istream& is);
+// Write one entry to a trace file
+void write_trace_entry(std::ostream& os, const Trace_entry& entry);
+// Read the next entry of a trace file; return false at the end of the trace.
+// Throw Error exception if the entry is invalid.
+bool read_trace_entry(std::istream& is, Trace_entry& entry);
+
+// An input stream buffer that reads from another one without buffering,
+// recording every character consumed and whether the last one was only peeked at.
+class Recording_istreambuf : public std::streambuf {
+public:
+    Recording_istreambuf(std::streambuf* source_) : source{source_} {}
+
+    // Return and forget everything recorded so far
+    std::string take_recording();
+    // Return true if the character after the recording has been peeked at
+    bool peeked() const
+        { return peek_pending; }
+
+protected:
+    int_type underflow() override;
+    int_type uflow() override;
+
+private:
+    std::streambuf* source;
+    std::string recording;
+    bool peek_pending = false;
+};
+
+// An output stream buffer that writes through to another one, recording everything written
+class Recording_ostreambuf : public std::streambuf {
+public:
+    Recording_ostreambuf(std::streambuf* destination_) : destination{destination_} {}
+
+    // Return and forget everything recorded so far
+    std::string take_recording();
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    std::streambuf* destination;
+    std::string recording;
+};
+
+/*
+A Capture_session installs recording buffers on an input and an output stream
+for its lifetime and writes a trace entry for each command it is told about.
+*/
+class Capture_session {
+public:
+    // Start capturing the two streams into the trace file.
+    // Throw Error exception if the trace file cannot be opened.
+    Capture_session(std::istream& in_, std::ostream& out_, const std::string& filename);
+    // Stop capturing and restore the streams' own buffers
+    ~Capture_session();
+
+    Capture_session(const Capture_session&) = delete;
+    Capture_session& operator=(const Capture_session&) = delete;
+
+    // Mark the start of a command, after its prompt has been written
+    void begin_command();
+    // Note that the command's input has arrived and it is about to execute
+    void command_arrived();
+    // Mark the end of a command and write its trace entry
+    void end_command(Result_class result);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::istream& in;
+    std::ostream& out;
+    std::streambuf* in_original;
+    std::streambuf* out_original;
+    Recording_istreambuf in_recorder;
+    Recording_ostreambuf out_recorder;
+    std::ofstream trace;
+    Clock::time_point start;
+    Clock::time_point arrival;
+    bool arrived = false;
+
+    long long microseconds_since(Clock::time_point from, Clock::time_point to) const;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "Catalog.h"
+
+#include <algorithm>
+
+#include <string>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Collection.h"
+#include "Minhash.h"
+#include "Record.h"
+#include "Trace.h"
+#include "Utility.h"
+
+using namespace std;
+
+// Return a pointer to the Collection with the given name, or nullptr if there is none
+Collection* Catalog::find(const string& name)
+{
+    TRACE_SPAN("catalog_find");
+    auto collection_it = collections.find(name);
+    return collection_it == collections.end() ? nullptr : &collection_it->second;
+}
+
+// Move the Collection into the Catalog and return a reference to it.
+// Throw Error exception if there is already a Collection with the same name.
+Collection& Catalog::insert(Collection&& collection)
+{
+    string name = collection.get_name();
+    if (collections.find(name) != collections.end())
+    {
+        throw Error("Catalog already has a collection with this name!");
+    }
+    auto collection_it = collections.emplace(name, move(collection)).first;
+    try
+    {
+        ordered.insert(&collection_it->second);
+    } catch (...)
+    {
+        collections.erase(collection_it);
+        throw;
+    }
+    Collection& inserted = collection_it->second;
+    for_each(inserted.begin(), inserted.end(), [this](Record* record) { count_member(record); });
+    return inserted;
+}
+
+// Remove the Collection with the given name; do nothing if there is none
+void Catalog::erase(const string& name)
+{
+    auto collection_it = collections.find(name);
+    if (collection_it == collections.end())
+    {
+        return;
+    }
+    auto banded_it = banded.find(&collection_it->second);
+    if (banded_it != banded.end())
+    {
+        remove_from_buckets(banded_it->first, banded_it->second);
+        banded.erase(banded_it);
+    }
+    for_each(collection_it->second.begin(), collection_it->second.end(), [this](Record* record) { uncount_member(record); });
+    ordered.erase(&collection_it->second);
+    collections.erase(collection_it);
+}
+
+// Remove all Collections
+void Catalog::clear()
+{
+    for (auto& named_collection : collections)
+    {
+        const Collection& collection = named_collection.second;
+        for_each(collection.begin(), collection.end(), [this](Record* record) { uncount_member(record); });
+    }
+    band_buckets.clear();
+    banded.clear();
+    ordered.clear();
+    collections.clear();
+    // a Catalog moved from has no Collections but may still have their statistics
+    num_in_any = num_in_many = num_memberships = 0;
+}
+
+// Add a Record to a Collection in the Catalog, or remove it, as the Collection's own functions of the
+// same names do, and update the statistics
+void Catalog::add_member(Collection& collection, Record* record)
+{
+    collection.add_member(record);
+    count_member(record);
+}
+void Catalog::remove_member(Collection& collection, Record* record)
+{
+    collection.remove_member(record);
+    uncount_member(record);
+}
+vector<Record*> Catalog::add_members(Collection& collection, const Record_container& records)
+{
+    vector<Record*> added = collection.add_members(records);
+    for_each(added.begin(), added.end(), [this](Record* record) { count_member(record); });
+    return added;
+}
+vector<Record*> Catalog::remove_members(Collection& collection, const Record_container& records)
+{
+    vector<Record*> removed = collection.remove_members(records);
+    for_each(removed.begin(), removed.end(), [this](Record* record) { uncount_member(record); });
+    return removed;
+}
+
+// Update the statistics for a Record joining or leaving a Collection in the Catalog
+void Catalog::count_member(Record* record)
+{
+    int count = record->add_membership();
+    if (count == 1)
+    {
+        ++num_in_any;
+    } else if (count == 2)
+    {
+        ++num_in_many;
+    }
+    ++num_memberships;
+}
+void Catalog::uncount_member(Record* record)
+{
+    int count = record->remove_membership();
+    if (count == 0)
+    {
+        --num_in_any;
+    } else if (count == 1)
+    {
+        --num_in_many;
+    }
+    --num_memberships;
+}
+
+// Return the other Collections whose MinHash signatures have a band in common with that of the given one,
+// in no particular order. An empty Collection has no such Collections.
+vector<Collection*> Catalog::find_similar_candidates(const Collection& collection)
+{
+    update_bands();
+    vector<Collection*> candidates;
+    auto banded_it = banded.find(&collection);
+    if (banded_it == banded.end())
+    {
+        return candidates;
+    }
+    for (unsigned long long band_key : banded_it->second.band_keys)
+    {
+        const Band_bucket& bucket = band_buckets.find(band_key)->second;
+        candidates.insert(candidates.end(), bucket.begin(), bucket.end());
+    }
+    // a Collection similar in several bands is in several buckets
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+    candidates.erase(remove(candidates.begin(), candidates.end(), &collection), candidates.end());
+    return candidates;
+}
+
+// Index the bands of the Collections that have changed since they were last indexed
+void Catalog::update_bands()
+{
+    for (auto& named_collection : collections)
+    {
+        Collection* collection = &named_collection.second;
+        auto banded_it = banded.find(collection);
+        if (banded_it != banded.end())
+        {
+            if (banded_it->second.generation == collection->get_generation())
+            {
+                continue;
+            }
+            remove_from_buckets(collection, banded_it->second);
+            banded.erase(banded_it);
+        }
+        if (collection->empty())
+        {
+            continue;
+        }
+        Banded_collection bands;
+        bands.generation = collection->get_generation();
+        const Minhash_signature& signature = collection->get_signature();
+        for (int band = 0; band < MINHASH_BANDS; ++band)
+        {
+            bands.band_keys[band] = signature.band_key(band);
+        }
+        // if this runs out of memory part way, the buckets filled so far are emptied of the Collection again
+        try
+        {
+            for (unsigned long long band_key : bands.band_keys)
+            {
+                band_buckets[band_key].push_back(collection);
+            }
+            banded.emplace(collection, bands);
+        } catch (...)
+        {
+            remove_from_buckets(collection, bands);
+            throw;
+        }
+    }
+}
+
+// Remove a Collection from the band buckets it was indexed under, but not from banded
+void Catalog::remove_from_buckets(const Collection* collection, const Banded_collection& bands)
+{
+    for (unsigned long long band_key : bands.band_keys)
+    {
+        auto bucket_it = band_buckets.find(band_key);
+        if (bucket_it == band_buckets.end())
+        {
+            continue;
+        }
+        Band_bucket& bucket = bucket_it->second;
+        bucket.erase(remove(bucket.begin(), bucket.end(), collection), bucket.end());
+        if (bucket.empty())
+        {
+            band_buckets.erase(bucket_it);
+        }
+    }
+}
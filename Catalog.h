@@ -0,0 +1,123 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <array>
+#include <cstddef>
+#include <functional>
+
+#include <string>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Collection.h"
+#include "Memory.h"
+#include "Minhash.h"
+#include "Record.h"
+#include "Utility.h"
+
+/*
+A Catalog owns a group of Collections with unique names.
+Each Collection lives in its own node of a hash table keyed by name, so finding a
+Collection by name takes constant time and its address never changes while it is in the Catalog.
+A separately maintained set of pointers ordered by name provides the ordered view used for
+printing and saving.
+The Catalog also indexes the bands of each Collection's MinHash signature, so that the
+Collections likely to be similar to one can be found without comparing it with every other.
+The index is brought up to date when it is used, for the Collections whose generation has
+changed since they were last indexed.
+Members of the Collections in a Catalog are added and removed through the Catalog, which keeps
+statistics over them, and a count in each Record of the Collections in the Catalog it belongs to.
+*/
+
+// Container used for the ordered view of the Collections in a Catalog
+typedef std::set<Collection*, Less_than_ptr<Collection*>, Counting_allocator<Collection*, CATALOG_MEMORY>> Collection_set;
+
+class Catalog {
+
+public:
+    Catalog() = default;
+
+    // The ordered view points into the hash table, so a Catalog can be moved but not copied
+    Catalog(const Catalog&) = delete;
+    Catalog& operator=(const Catalog&) = delete;
+    Catalog(Catalog&&) = default;
+    Catalog& operator=(Catalog&&) = default;
+
+    // Return a pointer to the Collection with the given name, or nullptr if there is none
+    Collection* find(const std::string& name);
+
+    // Move the Collection into the Catalog and return a reference to it.
+    // Throw Error exception if there is already a Collection with the same name.
+    Collection& insert(Collection&& collection);
+
+    // Remove the Collection with the given name; do nothing if there is none
+    void erase(const std::string& name);
+
+    // Remove all Collections
+    void clear();
+
+    // Add a Record to a Collection in the Catalog, or remove it, as the Collection's own functions of the
+    // same names do, and update the statistics
+    void add_member(Collection& collection, Record* record);
+    void remove_member(Collection& collection, Record* record);
+    std::vector<Record*> add_members(Collection& collection, const Record_container& records);
+    std::vector<Record*> remove_members(Collection& collection, const Record_container& records);
+
+    // Statistics over the Collections in the Catalog: the number of Records in at least one Collection,
+    // the number in more than one, and the total number of memberships
+    int get_num_in_any() const
+        { return num_in_any; }
+    int get_num_in_many() const
+        { return num_in_many; }
+    int get_num_memberships() const
+        { return num_memberships; }
+
+    std::size_t size() const
+        { return collections.size(); }
+
+    bool empty() const
+        { return collections.empty(); }
+
+    // Iterate over the Collections in name order
+    Collection_set::const_iterator begin() const
+        { return ordered.begin(); }
+
+    Collection_set::const_iterator end() const
+        { return ordered.end(); }
+
+    // Return the other Collections whose MinHash signatures have a band in common with that of the given one,
+    // in no particular order. An empty Collection has no such Collections.
+    std::vector<Collection*> find_similar_candidates(const Collection& collection);
+
+private:
+    std::unordered_map<std::string, Collection, std::hash<std::string>, std::equal_to<std::string>,
+        Counting_allocator<std::pair<const std::string, Collection>, CATALOG_MEMORY>> collections;
+    Collection_set ordered;
+    int num_in_any = 0;
+    int num_in_many = 0;
+    int num_memberships = 0;
+
+    // The band keys a Collection was indexed under, and its generation then
+    struct Banded_collection {
+        unsigned long long generation;
+        std::array<unsigned long long, MINHASH_BANDS> band_keys;
+    };
+    typedef std::vector<Collection*, Counting_allocator<Collection*, CATALOG_MEMORY>> Band_bucket;
+    // the non-empty Collections that have been indexed, and the Collections indexed under each band key
+    std::unordered_map<const Collection*, Banded_collection, std::hash<const Collection*>, std::equal_to<const Collection*>,
+        Counting_allocator<std::pair<const Collection* const, Banded_collection>, CATALOG_MEMORY>> banded;
+    std::unordered_map<unsigned long long, Band_bucket, std::hash<unsigned long long>, std::equal_to<unsigned long long>,
+        Counting_allocator<std::pair<const unsigned long long, Band_bucket>, CATALOG_MEMORY>> band_buckets;
+
+    // Update the statistics for a Record joining or leaving a Collection in the Catalog
+    void count_member(Record* record);
+    void uncount_member(Record* record);
+    // Index the bands of the Collections that have changed since they were last indexed
+    void update_bands();
+    // Remove a Collection from the band buckets it was indexed under, but not from banded
+    void remove_from_buckets(const Collection* collection, const Banded_collection& bands);
+};
+
+#endif
@@ -9,18 +9,68 @@
 #include <set>
 #include <vector>
 
+#include "Minhash.h"
 #include "Record.h"
 #include "Utility.h"
 
 using namespace std;
 
+unsigned long long Collection::last_generation = 0;
+// add_members merges the Records in unless there are fewer than one for each this many members,
+// when inserting them one at a time costs less than copying every member
+const size_t MERGE_MEMBERS_RATIO = 16;
+
+// Construct a collection with the given name and the same elements as those in original
+Collection::Collection(const string& name_, const Collection& original) :
+    name{name_}, elements(original.elements), signature(original.signature)
+{
+}
+
+// Copies have the same members; moves transfer them, leaving the original empty
+Collection::Collection(const Collection& original) :
+    name{original.name}, elements(original.elements), signature(original.signature)
+{
+}
+Collection::Collection(Collection&& original) :
+    name{move(original.name)}, elements(move(original.elements)), signature(original.signature)
+{
+    original.elements.clear();
+    original.signature.clear();
+    original.new_generation();
+}
+Collection& Collection::operator=(const Collection& rhs)
+{
+    if (this != &rhs)
+    {
+        Record_set new_elements(rhs.elements);
+        name = rhs.name;
+        elements.swap(new_elements);
+        signature = rhs.signature;
+        new_generation();
+    }
+    return *this;
+}
+Collection& Collection::operator=(Collection&& rhs)
+{
+    if (this != &rhs)
+    {
+        name = move(rhs.name);
+        elements = move(rhs.elements);
+        rhs.elements.clear();
+        signature = rhs.signature;
+        rhs.signature.clear();
+        new_generation();
+        rhs.new_generation();
+    }
+    return *this;
+}
 /* Construct a Collection from an input file stream in save format, using the record list,
     restoring all the Record information.
     Record list is needed to resolve references to record members.
     No check made for whether the Collection already exists or not.
     Throw Error exception if invalid data discovered in file.
     string data input is read directly into the member variable. */
-Collection::Collection(ifstream& is, const vector<Record*>& library)
+Collection::Collection(ifstream& is, const Record_container& library)
 {
     int num;
     if (!(is >> name >> num))
@@ -28,6 +78,13 @@ Collection::Collection(ifstream& is, const vector<Record*>& library)
         throw Error(FILE_ERROR_MSG);
     }
     is.ignore(numeric_limits<streamsize>::max(), '\n');
+    read_members(is, num, library);
+}
+
+// Read the given number of member titles from the stream and add the Records with those titles.
+// Throw Error exception if a title is not in the library.
+void Collection::read_members(ifstream& is, int num, const Record_container& library)
+{
     for (int i = 0; i < num; i++)
     {
         string title;
@@ -38,7 +95,10 @@ Collection::Collection(ifstream& is, const vector<Record*>& library)
         {
             throw Error(FILE_ERROR_MSG);
         }
-        elements.insert(*record_it);
+        if (elements.insert(*record_it).second)
+        {
+            signature.add((*record_it)->get_ID());
+        }
     }
 }
 
@@ -50,6 +110,8 @@ void Collection::add_member(Record* record_ptr)
         throw Error("Record is already a member in the collection!");
     }
     elements.insert(record_ptr);
+    signature.add(record_ptr->get_ID());
+    new_generation();
 }
 // Return true if the record is present, false if not.
 bool Collection::is_member_present(Record* record_ptr) const
@@ -65,19 +127,123 @@ void Collection::remove_member(Record* record_ptr)
         throw Error("Record is not a member in the collection!");
     }
     elements.erase(it);
+    signature.remove(record_ptr->get_ID());
+    new_generation();
+}
+// Add the Records, which must be in title order, except those already present, and return those added.
+// Many Records are merged with the members in linear time; a few are inserted one at a time, in logarithmic
+// time each. If this throws, no Records are added.
+vector<Record*> Collection::add_members(const Record_container& records)
+{
+    vector<Record*> added;
+    added.reserve(records.size());
+    Less_than_ptr<Record*> less;
+    if (records.size() * MERGE_MEMBERS_RATIO < elements.size())
+    {
+        // a few Records go into a big set one at a time, each with the place after the one before as a hint;
+        // that place is right only if no member lies between them, so each insert takes logarithmic time at worst
+        auto hint = elements.begin();
+        try
+        {
+            for (Record* record_ptr : records)
+            {
+                size_t old_size = elements.size();
+                hint = elements.insert(hint, record_ptr);
+                ++hint;
+                if (elements.size() != old_size)
+                {
+                    added.push_back(record_ptr);
+                }
+            }
+        } catch (...)
+        {
+            for_each(added.begin(), added.end(), [this](Record* record_ptr) { elements.erase(record_ptr); });
+            throw;
+        }
+    } else
+    {
+        // otherwise the members and the Records are merged into a new set, each one inserted at its end
+        // in constant time, so that this takes time linear in their total
+        Record_set merged;
+        auto member_it = elements.begin();
+        for (Record* record_ptr : records)
+        {
+            for (; member_it != elements.end() && less(*member_it, record_ptr); ++member_it)
+            {
+                merged.insert(merged.end(), *member_it);
+            }
+            // a Record is already present if it is a member or was named just before
+            if ((member_it == elements.end() || less(record_ptr, *member_it)) && (merged.empty() || less(*merged.rbegin(), record_ptr)))
+            {
+                merged.insert(merged.end(), record_ptr);
+                added.push_back(record_ptr);
+            }
+        }
+        for (; member_it != elements.end(); ++member_it)
+        {
+            merged.insert(merged.end(), *member_it);
+        }
+        elements.swap(merged);
+    }
+    for_each(added.begin(), added.end(), [this](Record* record_ptr) { signature.add(record_ptr->get_ID()); });
+    if (!added.empty())
+    {
+        new_generation();
+    }
+    return added;
+}
+// Remove the Records, except those not present, and return those removed
+vector<Record*> Collection::remove_members(const Record_container& records)
+{
+    vector<Record*> removed;
+    removed.reserve(records.size());
+    for (Record* record_ptr : records)
+    {
+        auto member_it = elements.find(record_ptr);
+        if (member_it != elements.end())
+        {
+            elements.erase(member_it);
+            signature.remove(record_ptr->get_ID());
+            removed.push_back(record_ptr);
+        }
+    }
+    if (!removed.empty())
+    {
+        new_generation();
+    }
+    return removed;
+}
+// discard all members
+void Collection::clear()
+{
+    elements.clear();
+    signature.clear();
+    new_generation();
+}
+
+// Return the MinHash signature of the members' IDs, first rebuilding it if a removal left it stale
+const Minhash_signature& Collection::get_signature() const
+{
+    if (signature.is_stale())
+    {
+        signature.rebuild(elements.begin(), elements.end(), [](Record* record) { return record->get_ID(); });
+    }
+    return signature;
 }
 
 // Write a Collection's data to a stream in save format, with endl as specified.
 void Collection::save(ostream& os) const
 {
     os << name << " " << elements.size() << "\n";
-    for_each(elements.begin(), elements.end(), [&os](Record* record) { os << record->get_title() << "\n"; });
+    for_each(elements.begin(), elements.end(), [&os](Record* record) { record->print_title(os); os << "\n"; });
 }
 
 // Combine this collection with rhs
 Collection& Collection::operator+=(const Collection &rhs)
 {
-    for_each(rhs.elements.begin(), rhs.elements.end(), [this](Record* record) { if (!is_member_present(record)) { elements.insert(record); }});
+    for_each(rhs.elements.begin(), rhs.elements.end(), [this](Record* record) { elements.insert(record); });
+    signature.merge(rhs.get_signature());
+    new_generation();
     return *this;
 }
 
@@ -96,4 +262,11 @@ ostream& operator<< (ostream& os, const Collection& collection)
         copy(collection.elements.begin(), collection.elements.end(), out_it);
     }
     return os;
-}
\ No newline at end of file
+}
+
+// Print a Collection pointer's data
+ostream& operator<< (ostream& os, const Collection* collection)
+{
+    os << *collection;
+    return os;
+}
@@ -1,6 +1,7 @@
 #ifndef COLLECTION_H
 #define COLLECTION_H
 
+#include <cstddef>
 #include <fstream>
 #include <ostream>
 
@@ -8,6 +9,8 @@
 #include <set>
 #include <vector>
 
+#include "Memory.h"
+#include "Minhash.h"
 #include "Record.h"
 #include "Utility.h"
 
@@ -15,10 +18,20 @@
 represented as pointers to Records.
 Collection objects manage their own Record container. 
 The container of Records is not available to clients.
+The members of a Collection in a Catalog are added and removed through the Catalog,
+which keeps statistics over the members of its Collections.
+Each Collection also has a generation number, which changes whenever its members change
+and is never the same for two different states of any Collections.
+A MinHash signature of the members' IDs is kept along with the members, for estimating
+how similar two Collections are.
 */
 
+// Set of records in title order whose memory is counted under the given category
+template<Memory_category Category>
+using Counted_record_set = std::set<Record*, Less_than_ptr<Record*>, Counting_allocator<Record*, Category>>;
+
 // Container used to hold the records contained in a collection
-typedef std::set<Record*, Less_than_ptr<Record*>> Record_set;
+typedef Counted_record_set<MEMBERSHIP_MEMORY> Record_set;
 
 class Collection {
 
@@ -27,7 +40,13 @@ public:
 	Collection(const std::string& name_) : name{name_} {}
 
 	// Construct a collection with the given name and the same elements as those in original
-	Collection(const std::string& name_, const Collection& original) : name{name_}, elements(original.elements) {}
+	Collection(const std::string& name_, const Collection& original);
+
+	// Copies have the same members; moves transfer them, leaving the original empty
+	Collection(const Collection& original);
+	Collection(Collection&& original);
+	Collection& operator=(const Collection& rhs);
+	Collection& operator=(Collection&& rhs);
 	
 	/* Construct a Collection from an input file stream in save format, using the record list,
 	restoring all the Record information.
@@ -35,14 +54,24 @@ public:
 	No check made for whether the Collection already exists or not.
 	Throw Error exception if invalid data discovered in file.
 	std::string data input is read directly into the member variable. */
-    Collection(std::ifstream& is, const std::vector<Record*>& library);
+    Collection(std::ifstream& is, const Record_container& library);
 
 	// Accessors
-	std::string get_name() const
+	const std::string& get_name() const
 		{return name;}
 
-	const Record_set get_elements() const
+	// A read-only view of the members, valid until the Collection is modified
+	const Record_set& get_elements() const
 		{return elements;}
+
+	// Iterate over the members in title order without copying them
+	Record_set::const_iterator begin() const
+		{ return elements.begin(); }
+	Record_set::const_iterator end() const
+		{ return elements.end(); }
+	// Return the number of members
+	std::size_t size() const
+		{ return elements.size(); }
 		
 	// Add the Record, throw exception if there is already a Record with the same title.
 	void add_member(Record* record_ptr);
@@ -53,9 +82,14 @@ public:
 	bool is_member_present(Record* record_ptr) const;
 	// Remove the specified Record, throw exception if the record was not found.
 	void remove_member(Record* record_ptr);
+	// Add the Records, which must be in title order, except those already present, and return those added.
+	// Many Records are merged with the members in linear time; a few are inserted one at a time, in logarithmic
+	// time each. If this throws, no Records are added.
+	std::vector<Record*> add_members(const Record_container& records);
+	// Remove the Records, except those not present, and return those removed
+	std::vector<Record*> remove_members(const Record_container& records);
 	// discard all members
-	void clear()
-		{ elements.clear(); }
+	void clear();
 
 	// Write a Collections's data to a stream in save format, with endl as specified.
 	void save(std::ostream& os) const;
@@ -71,11 +105,29 @@ public:
 
 	bool operator!=(const Collection &rhs) const {return name != rhs.name; }
 	
+	// Return a number that changes whenever the members change
+	unsigned long long get_generation() const
+		{ return generation; }
+
+	// Return the MinHash signature of the members' IDs, first rebuilding it if a removal left it stale
+	const Minhash_signature& get_signature() const;
+
 	friend std::ostream& operator<< (std::ostream& os, const Collection& collection);
 		
 private:
+	static unsigned long long last_generation;
+
 	std::string name;
     Record_set elements;
+	unsigned long long generation = ++last_generation;
+	// rebuilt when it is asked for, so that it can be stale until then
+	mutable Minhash_signature signature;
+
+	// Give the Collection a new generation number after its members change
+	void new_generation()
+		{ generation = ++last_generation; }
+	// Read the given number of member titles from the stream and add the Records with those titles
+	void read_members(std::ifstream& is, int num, const Record_container& library);
 
     void print_record_title(Record* record, std::ostream& os);
 };
@@ -83,4 +135,7 @@ private:
 // Print the Collection data
 std::ostream& operator<< (std::ostream& os, const Collection& collection);
 
+// Print a Collection pointer's data
+std::ostream& operator<< (std::ostream& os, const Collection* collection);
+
 #endif
\ No newline at end of file
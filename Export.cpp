@@ -0,0 +1,229 @@
+#include "Export.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Record.h"
+#include "Utility.h"
+
+using namespace std;
+
+const char * const EXPORT_HEADER = "P3COLS1\n";
+const size_t EXPORT_HEADER_SIZE = 8;
+// the most rows in a group of each table; a group's columns are held in memory until it is written
+const size_t LIBRARY_GROUP_ROWS = 1 << 16;
+const size_t COLLECTION_GROUP_ROWS = 1 << 12;
+const size_t MEMBERSHIP_GROUP_ROWS = 1 << 16;
+
+// Add a signed number to some bytes as a zigzag-encoded varint
+void append_signed_varint(string& bytes, long long number)
+{
+    append_varint(bytes, number < 0 ? ~(static_cast<unsigned long long>(number) << 1) : static_cast<unsigned long long>(number) << 1);
+}
+
+// Add some numbers to a column as runs of equal numbers, each as its length and the number
+template<typename Number>
+void append_runs(string& column, const vector<Number>& numbers)
+{
+    for (size_t run_begin = 0, run_end; run_begin < numbers.size(); run_begin = run_end)
+    {
+        for (run_end = run_begin + 1; run_end < numbers.size() && numbers[run_end] == numbers[run_begin]; ++run_end)
+            ;
+        append_varint(column, run_end - run_begin);
+        append_varint(column, numbers[run_begin]);
+    }
+}
+
+// Add strings to a column as their lengths followed by the size of the blob of their characters and the blob
+void append_lengths_and_blob(string& column, const vector<size_t>& lengths, const string& blob)
+{
+    for_each(lengths.begin(), lengths.end(), [&column](size_t length) { append_varint(column, length); });
+    append_varint(column, blob.size());
+    column += blob;
+}
+
+// Create the export file. Throw Error exception if it cannot be opened.
+Columnar_writer::Columnar_writer(const string& filename) :
+    file(filename.c_str(), ios::binary)
+{
+    if (!file)
+    {
+        throw Error("Could not open file!");
+    }
+    file.write(EXPORT_HEADER, EXPORT_HEADER_SIZE);
+}
+
+// Add a record to the library table; records are added in title order
+void Columnar_writer::add_record(const Record& record)
+{
+    IDs.push_back(record.get_ID());
+    auto medium_it = medium_numbers.find(record.get_medium());
+    if (medium_it == medium_numbers.end())
+    {
+        medium_it = medium_numbers.emplace(record.get_medium(), static_cast<int>(medium_dictionary.size())).first;
+        medium_dictionary.push_back(record.get_medium());
+    }
+    medium_indexes.push_back(medium_it->second);
+    ratings.push_back(record.get_rating());
+    record.copy_title(title_buffer);
+    title_lengths.push_back(title_buffer.size());
+    titles += title_buffer;
+    ++num_records;
+    if (IDs.size() == LIBRARY_GROUP_ROWS)
+    {
+        write_library_group();
+    }
+}
+
+// Add a collection with the given number of members to the collections table, and then its members'
+// IDs with add_member; collections are added in name order
+void Columnar_writer::add_collection(const string& name, size_t num_members)
+{
+    name_lengths.push_back(name.size());
+    names += name;
+    sizes.push_back(num_members);
+    ++num_collections;
+    if (sizes.size() == COLLECTION_GROUP_ROWS)
+    {
+        write_collection_group();
+    }
+}
+void Columnar_writer::add_member(int ID)
+{
+    memberships.emplace_back(num_collections - 1, ID);
+    ++num_memberships;
+    if (memberships.size() == MEMBERSHIP_GROUP_ROWS)
+    {
+        write_membership_group();
+    }
+}
+
+// Write what is left and close the file. Throw Error exception if any of the file could not be written.
+void Columnar_writer::finish()
+{
+    write_library_group();
+    write_membership_group();
+    write_collection_group();
+    string footer(1, 'E');
+    append_varint(footer, num_records);
+    append_varint(footer, num_collections);
+    append_varint(footer, num_memberships);
+    file.write(footer.data(), footer.size());
+    file.close();
+    if (!file)
+    {
+        throw Error("Could not write the export file!");
+    }
+}
+
+// Write the filled rows of a table as a row group and empty them; do nothing if there are none
+void Columnar_writer::write_library_group()
+{
+    if (IDs.empty())
+    {
+        return;
+    }
+    write_group_start('L', IDs.size());
+    string column;
+    int previous_ID = 0;
+    for (int ID : IDs)
+    {
+        append_signed_varint(column, static_cast<long long>(ID) - previous_ID);
+        previous_ID = ID;
+    }
+    write_column(column);
+
+    column.clear();
+    append_varint(column, medium_dictionary.size());
+    for_each(medium_dictionary.begin(), medium_dictionary.end(), [&column](const string& medium)
+        { append_varint(column, medium.size()); column += medium; });
+    append_runs(column, medium_indexes);
+    write_column(column);
+
+    column.clear();
+    append_runs(column, ratings);
+    write_column(column);
+
+    column.clear();
+    append_lengths_and_blob(column, title_lengths, titles);
+    write_column(column);
+
+    IDs.clear();
+    medium_indexes.clear();
+    medium_dictionary.clear();
+    medium_numbers.clear();
+    ratings.clear();
+    title_lengths.clear();
+    titles.clear();
+}
+void Columnar_writer::write_collection_group()
+{
+    if (sizes.empty())
+    {
+        return;
+    }
+    write_group_start('C', sizes.size());
+    string column;
+    append_lengths_and_blob(column, name_lengths, names);
+    write_column(column);
+
+    column.clear();
+    for_each(sizes.begin(), sizes.end(), [&column](size_t size) { append_varint(column, size); });
+    write_column(column);
+
+    name_lengths.clear();
+    names.clear();
+    sizes.clear();
+}
+void Columnar_writer::write_membership_group()
+{
+    if (memberships.empty())
+    {
+        return;
+    }
+    // the collections of these memberships must come first
+    write_collection_group();
+    // members arrive in title order; in ID order the differences are small
+    sort(memberships.begin(), memberships.end());
+    write_group_start('M', memberships.size());
+    vector<unsigned long long> collection_numbers;
+    collection_numbers.reserve(memberships.size());
+    transform(memberships.begin(), memberships.end(), back_inserter(collection_numbers),
+        [](const pair<unsigned long long, int>& membership) { return membership.first; });
+    string column;
+    append_runs(column, collection_numbers);
+    write_column(column);
+
+    column.clear();
+    int previous_ID = 0;
+    for (const auto& membership : memberships)
+    {
+        append_signed_varint(column, static_cast<long long>(membership.second) - previous_ID);
+        previous_ID = membership.second;
+    }
+    write_column(column);
+
+    memberships.clear();
+}
+
+// Write a table tag and number of rows, or a column, to the file
+void Columnar_writer::write_group_start(char tag, size_t num_rows)
+{
+    string start(1, tag);
+    append_varint(start, num_rows);
+    file.write(start.data(), start.size());
+}
+void Columnar_writer::write_column(const string& column)
+{
+    string size;
+    append_varint(size, column.size());
+    file.write(size.data(), size.size());
+    file.write(column.data(), column.size());
+}
@@ -0,0 +1,101 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <cstddef>
+#include <fstream>
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Record.h"
+
+/*
+A columnar export holds the library and catalog in a binary form that analytics tools can read a column
+at a time, without parsing the text of a saved library. The export is written as it goes, a group of rows
+at a time, so its memory use does not grow with the size of the library.
+
+The file starts with the 8 bytes "P3COLS1\n". Numbers are varints as in the change feed (7 bits per byte,
+low bits first, high bit set on every byte but the last), a signed number is zigzag encoded first
+(0, -1, 1, -2, ... as 0, 1, 2, 3, ...), and a string is its length followed by its characters.
+The rest of the file is a sequence of row groups, each a table tag, its number of rows, and then each
+of its columns, as the column's size in bytes followed by that many bytes, so a reader can skip a column.
+The file ends with the tag 'E' and the total numbers of records, collections and memberships.
+
+    'L' library, in title order:
+        ID          - each ID as the signed difference from the one before (from 0 for the first)
+        medium      - a dictionary of the group's mediums, as their number and then the strings,
+                      followed by runs of rows with the same medium, as the run length and dictionary index
+        rating      - runs of rows with the same rating, as the run length and rating (0 when unrated)
+        title       - the length of each title, which gives its offset, and then the size and bytes of the
+                      blob of all the titles one after another
+    'C' collections, in name order, each numbered by its position in the table from 0:
+        name        - the lengths and blob of the names, as for titles
+        size        - the number of members of each
+    'M' memberships, in collection number order, and within each group in record ID order:
+        collection  - runs of rows with the same collection, as the run length and collection number
+        record      - each record ID as the signed difference from the one before
+A membership group is written only after the collection groups that hold its collections. The members of
+a collection may be split across groups, and are then in ID order only within each group, since putting
+them all in order would mean holding all of a collection's members in memory at once.
+*/
+
+class Columnar_writer {
+public:
+    // Create the export file. Throw Error exception if it cannot be opened.
+    Columnar_writer(const std::string& filename);
+
+    Columnar_writer(const Columnar_writer&) = delete;
+    Columnar_writer& operator=(const Columnar_writer&) = delete;
+
+    // Add a record to the library table; records are added in title order
+    void add_record(const Record& record);
+    // Add a collection with the given number of members to the collections table, and then its members'
+    // IDs with add_member; collections are added in name order
+    void add_collection(const std::string& name, std::size_t num_members);
+    void add_member(int ID);
+
+    // Write what is left and close the file. Throw Error exception if any of the file could not be written.
+    void finish();
+
+    // The numbers of records, collections and memberships added
+    unsigned long long get_num_records() const
+        { return num_records; }
+    unsigned long long get_num_collections() const
+        { return num_collections; }
+    unsigned long long get_num_memberships() const
+        { return num_memberships; }
+
+private:
+    std::ofstream file;
+    unsigned long long num_records = 0, num_collections = 0, num_memberships = 0;
+
+    // the rows of the library group being filled
+    std::vector<int> IDs;
+    std::vector<int> medium_indexes;
+    std::vector<std::string> medium_dictionary;
+    std::unordered_map<std::string, int> medium_numbers;
+    std::vector<int> ratings;
+    std::vector<std::size_t> title_lengths;
+    std::string titles;
+    std::string title_buffer;
+
+    // the rows of the collection group being filled
+    std::vector<std::size_t> name_lengths;
+    std::string names;
+    std::vector<std::size_t> sizes;
+
+    // the rows of the membership group being filled, as collection number and record ID
+    std::vector<std::pair<unsigned long long, int>> memberships;
+
+    // Write the filled rows of a table as a row group and empty them; do nothing if there are none
+    void write_library_group();
+    void write_collection_group();
+    void write_membership_group();
+    // Write a table tag and number of rows, or a column, to the file
+    void write_group_start(char tag, std::size_t num_rows);
+    void write_column(const std::string& column);
+};
+
+#endif
@@ -0,0 +1,488 @@
+#include "Feed.h"
+
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "Utility.h"
+
+using namespace std;
+
+const char * const FEED_HEADER = "P3FEED1\n";
+const size_t FEED_HEADER_SIZE = 8;
+// no change comes close to this size; a longer one means the feed is corrupt
+const unsigned long long MAX_CHANGE_SIZE = 1 << 24;
+// how long the reader waits before looking for more at the end of the feed
+const int FEED_POLL_MS = 10;
+
+const char * INVALID_FEED_MSG = "Invalid change feed!";
+const char * FEED_READ_FAIL_MSG = "Could not read the change feed!";
+
+// Read a varint from the bytes before end, starting at pos and moving pos past it.
+// Return false if the bytes end first. Throw Error exception if it is too long to be valid.
+bool read_varint(const string& bytes, size_t& pos, size_t end, unsigned long long& number)
+{
+    number = 0;
+    for (int shift = 0; pos < end; shift += 7)
+    {
+        if (shift > 63)
+        {
+            throw Error(INVALID_FEED_MSG);
+        }
+        unsigned char byte = bytes[pos++];
+        number |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read the fields of a change from the bytes before end. Throw Error exception if they are not all there.
+int read_int_field(const string& bytes, size_t& pos, size_t end)
+{
+    unsigned long long number;
+    if (!read_varint(bytes, pos, end, number))
+    {
+        throw Error(INVALID_FEED_MSG);
+    }
+    return static_cast<int>(static_cast<unsigned int>(number));
+}
+string read_string_field(const string& bytes, size_t& pos, size_t end)
+{
+    unsigned long long length;
+    if (!read_varint(bytes, pos, end, length) || length > end - pos)
+    {
+        throw Error(INVALID_FEED_MSG);
+    }
+    pos += length;
+    return bytes.substr(pos - length, length);
+}
+
+// Decode a change of the given size starting at pos. Throw Error exception if it is invalid.
+Feed_change decode_change(const string& bytes, size_t pos, size_t size)
+{
+    size_t end = pos + size;
+    Feed_change change;
+    change.op = static_cast<Feed_op>(bytes[pos++]);
+    switch (change.op)
+    {
+        case Feed_op::ADD_RECORD:
+            change.ID = read_int_field(bytes, pos, end);
+            change.rating = read_int_field(bytes, pos, end);
+            change.name = read_string_field(bytes, pos, end);
+            change.title = read_string_field(bytes, pos, end);
+            break;
+        case Feed_op::DELETE_RECORD:
+            change.ID = read_int_field(bytes, pos, end);
+            break;
+        case Feed_op::MODIFY_RATING:
+            change.ID = read_int_field(bytes, pos, end);
+            change.rating = read_int_field(bytes, pos, end);
+            break;
+        case Feed_op::MODIFY_TITLE:
+            change.ID = read_int_field(bytes, pos, end);
+            change.title = read_string_field(bytes, pos, end);
+            break;
+        case Feed_op::ADD_COLLECTION:
+        case Feed_op::DELETE_COLLECTION:
+            change.name = read_string_field(bytes, pos, end);
+            break;
+        case Feed_op::ADD_MEMBER:
+        case Feed_op::DELETE_MEMBER:
+            change.name = read_string_field(bytes, pos, end);
+            change.ID = read_int_field(bytes, pos, end);
+            break;
+        case Feed_op::SNAPSHOT:
+            if (!read_varint(bytes, pos, end, change.checksum))
+            {
+                throw Error(INVALID_FEED_MSG);
+            }
+            break;
+        case Feed_op::CLEAR_LIBRARY:
+        case Feed_op::CLEAR_CATALOG:
+        case Feed_op::CLEAR_ALL:
+        case Feed_op::COMMIT:
+            break;
+        default:
+            throw Error(INVALID_FEED_MSG);
+    }
+    if (pos != end)
+    {
+        throw Error(INVALID_FEED_MSG);
+    }
+    return change;
+}
+
+// Return a checksum of the contents of a file. Throw Error exception if it cannot be read.
+unsigned long long file_checksum(const string& filename)
+{
+    ifstream file(filename.c_str(), ios::binary);
+    if (!file)
+    {
+        throw Error("Could not open file!");
+    }
+    // 64-bit FNV-1a
+    unsigned long long checksum = 14695981039346656037ULL;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+    {
+        for (streamsize i = 0; i < file.gcount(); ++i)
+        {
+            checksum = (checksum ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ULL;
+        }
+    }
+    if (file.bad())
+    {
+        throw Error("Could not read file!");
+    }
+    return checksum;
+}
+
+// Open the feed at the given path, creating or emptying a file; opening a named pipe waits
+// until a replica opens it too. Throw Error exception if it cannot be opened.
+Feed_writer::Feed_writer(const string& path)
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw Error("Could not open the change feed!");
+    }
+    // a replica that goes away is noticed when writing to it fails
+    signal(SIGPIPE, SIG_IGN);
+    if (!write_all(string(FEED_HEADER, FEED_HEADER_SIZE)))
+    {
+        close(fd);
+        throw Error("Could not write the change feed!");
+    }
+    num_bytes = FEED_HEADER_SIZE;
+}
+
+Feed_writer::~Feed_writer()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// Add a change to those of the current command
+void Feed_writer::record_added(int ID, int rating, const string& medium, const string& title)
+{
+    begin_change(Feed_op::ADD_RECORD);
+    add_number(ID);
+    add_number(rating);
+    add_string(medium);
+    add_string(title);
+    end_change();
+}
+void Feed_writer::record_deleted(int ID)
+{
+    begin_change(Feed_op::DELETE_RECORD);
+    add_number(ID);
+    end_change();
+}
+void Feed_writer::rating_modified(int ID, int rating)
+{
+    begin_change(Feed_op::MODIFY_RATING);
+    add_number(ID);
+    add_number(rating);
+    end_change();
+}
+void Feed_writer::title_modified(int ID, const string& title)
+{
+    begin_change(Feed_op::MODIFY_TITLE);
+    add_number(ID);
+    add_string(title);
+    end_change();
+}
+void Feed_writer::collection_added(const string& name)
+{
+    begin_change(Feed_op::ADD_COLLECTION);
+    add_string(name);
+    end_change();
+}
+void Feed_writer::collection_deleted(const string& name)
+{
+    begin_change(Feed_op::DELETE_COLLECTION);
+    add_string(name);
+    end_change();
+}
+void Feed_writer::member_added(const string& name, int ID)
+{
+    begin_change(Feed_op::ADD_MEMBER);
+    add_string(name);
+    add_number(ID);
+    end_change();
+}
+void Feed_writer::member_deleted(const string& name, int ID)
+{
+    begin_change(Feed_op::DELETE_MEMBER);
+    add_string(name);
+    add_number(ID);
+    end_change();
+}
+void Feed_writer::library_cleared()
+{
+    begin_change(Feed_op::CLEAR_LIBRARY);
+    end_change();
+}
+void Feed_writer::catalog_cleared()
+{
+    begin_change(Feed_op::CLEAR_CATALOG);
+    end_change();
+}
+void Feed_writer::all_cleared()
+{
+    begin_change(Feed_op::CLEAR_ALL);
+    end_change();
+}
+void Feed_writer::snapshot_saved(unsigned long long checksum)
+{
+    begin_change(Feed_op::SNAPSHOT);
+    add_number(checksum);
+    end_change();
+}
+
+// Write the changes of the current command to the feed, if it made any.
+// Throw Error exception if the feed cannot be written; after that, the feed is closed
+// and changes are discarded.
+void Feed_writer::commit()
+{
+    if (pending.empty())
+    {
+        return;
+    }
+    unsigned long long num_pending = num_pending_changes;
+    num_pending_changes = 0;
+    if (fd < 0)
+    {
+        pending.clear();
+        return;
+    }
+    begin_change(Feed_op::COMMIT);
+    end_change();
+    bool written = write_all(pending);
+    num_bytes += pending.size();
+    pending.clear();
+    if (!written)
+    {
+        close(fd);
+        fd = -1;
+        throw Error("Could not write the change feed!");
+    }
+    ++num_commits;
+    num_changes += num_pending;
+}
+
+// Start encoding a change, add its fields, and add it to the pending changes
+void Feed_writer::begin_change(Feed_op op)
+{
+    change.clear();
+    change += static_cast<char>(op);
+}
+void Feed_writer::add_number(unsigned long long number)
+{
+    append_varint(change, number);
+}
+void Feed_writer::add_string(const string& text)
+{
+    append_varint(change, text.size());
+    change += text;
+}
+void Feed_writer::end_change()
+{
+    append_varint(pending, change.size());
+    pending += change;
+    if (change[0] != static_cast<char>(Feed_op::COMMIT))
+    {
+        ++num_pending_changes;
+    }
+}
+
+// Write all of some bytes to the feed; return false if it fails
+bool Feed_writer::write_all(const string& bytes)
+{
+    size_t written = 0;
+    while (written < bytes.size())
+    {
+        ssize_t num_written = write(fd, bytes.data() + written, bytes.size() - written);
+        if (num_written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (num_written <= 0)
+        {
+            return false;
+        }
+        written += num_written;
+    }
+    return true;
+}
+
+// Open the feed at the given path and start the thread that reads it; opening a named pipe
+// waits until the primary opens it too. Throw Error exception if it cannot be opened.
+Feed_reader::Feed_reader(const string& path) : stopping{false}
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw Error("Could not open the change feed!");
+    }
+    reader = thread(&Feed_reader::read_feed, this);
+}
+
+// Stop the reading thread and close the feed
+Feed_reader::~Feed_reader()
+{
+    stopping.store(true);
+    reader.join();
+    close(fd);
+}
+
+// Return the changes of the commands committed to the feed since the last call, without their
+// COMMIT changes, waiting up to the given number of milliseconds for one if there are none yet.
+// Throw Error exception if the feed is invalid or cannot be read.
+vector<Feed_change> Feed_reader::take_changes(int wait_ms)
+{
+    string bytes;
+    {
+        unique_lock<mutex> lock(received_mutex);
+        if (committed_end == 0 && wait_ms > 0)
+        {
+            committed.wait_for(lock, chrono::milliseconds(wait_ms), [this] { return committed_end > 0 || failure; });
+        }
+        // the complete commands before a failure are still good
+        if (committed_end == 0 && failure)
+        {
+            throw Error(failure);
+        }
+        bytes = received.substr(0, committed_end);
+        received.erase(0, committed_end);
+        scanned_end -= committed_end;
+        committed_end = 0;
+    }
+    vector<Feed_change> changes;
+    size_t pos = 0;
+    while (pos < bytes.size())
+    {
+        unsigned long long size;
+        read_varint(bytes, pos, bytes.size(), size);
+        Feed_change change = decode_change(bytes, pos, size);
+        pos += size;
+        if (change.op == Feed_op::COMMIT)
+        {
+            ++num_commits;
+        } else
+        {
+            changes.push_back(move(change));
+            ++num_changes;
+        }
+    }
+    return changes;
+}
+
+// The number of bytes read but not taken yet
+size_t Feed_reader::get_num_waiting() const
+{
+    lock_guard<mutex> lock(received_mutex);
+    return received.size();
+}
+
+// Read the feed until stopped, waiting for more at its end
+void Feed_reader::read_feed()
+{
+    char buffer[65536];
+    while (!stopping.load())
+    {
+        pollfd poll_fd = {fd, POLLIN, 0};
+        if (poll(&poll_fd, 1, FEED_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        ssize_t num_read = read(fd, buffer, sizeof(buffer));
+        if (num_read < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (num_read == 0)
+        {
+            // the end of the feed for now; the primary may write more later
+            this_thread::sleep_for(chrono::milliseconds(FEED_POLL_MS));
+            continue;
+        }
+        lock_guard<mutex> lock(received_mutex);
+        if (num_read < 0)
+        {
+            failure = FEED_READ_FAIL_MSG;
+            committed.notify_all();
+            return;
+        }
+        received.append(buffer, num_read);
+        if (!header_checked)
+        {
+            if (received.size() < FEED_HEADER_SIZE)
+            {
+                continue;
+            }
+            if (received.compare(0, FEED_HEADER_SIZE, FEED_HEADER) != 0)
+            {
+                failure = INVALID_FEED_MSG;
+                committed.notify_all();
+                return;
+            }
+            received.erase(0, FEED_HEADER_SIZE);
+            header_checked = true;
+        }
+        // find the complete changes that have arrived, and the end of the last complete command
+        size_t old_committed_end = committed_end;
+        try
+        {
+            while (true)
+            {
+                size_t pos = scanned_end;
+                unsigned long long size;
+                if (!read_varint(received, pos, received.size(), size))
+                {
+                    break;
+                }
+                if (size == 0 || size > MAX_CHANGE_SIZE)
+                {
+                    throw Error(INVALID_FEED_MSG);
+                }
+                if (received.size() - pos < size)
+                {
+                    break;
+                }
+                scanned_end = pos + size;
+                if (static_cast<Feed_op>(received[pos]) == Feed_op::COMMIT)
+                {
+                    committed_end = scanned_end;
+                }
+            }
+        } catch (Error& e)
+        {
+            failure = e.msg;
+            committed.notify_all();
+            return;
+        }
+        if (committed_end != old_committed_end)
+        {
+            committed.notify_all();
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include <string>
+#include <vector>
+
+/*
+A change feed carries every change made to a library, in a compact binary form, from the process
+that makes them to read-only replicas that apply them to their own copies of the library.
+The feed may be a file, which replicas follow as it grows, or a named pipe.
+
+A feed starts with the 8 bytes "P3FEED1\n". Each change is then its length as a varint
+(7 bits per byte, low bits first, high bit set on every byte but the last) followed by that
+many bytes: the Feed_op, then the change's fields, integers as varints and strings as their
+length as a varint followed by their characters. The changes made by one command are followed
+by a COMMIT change, and a replica applies the changes of a command only once it has them all.
+
+A SNAPSHOT change marks where in the feed the library was saved to a file, identified by a
+checksum of the file, so that a replica can start from the saved library and apply only the
+changes made after it.
+*/
+
+enum class Feed_op : unsigned char {
+    ADD_RECORD = 1,     // ID, rating, medium (in name), title
+    DELETE_RECORD,      // ID
+    MODIFY_RATING,      // ID, rating
+    MODIFY_TITLE,       // ID, title
+    ADD_COLLECTION,     // name
+    DELETE_COLLECTION,  // name
+    ADD_MEMBER,         // name, ID
+    DELETE_MEMBER,      // name, ID
+    CLEAR_LIBRARY,
+    CLEAR_CATALOG,
+    CLEAR_ALL,
+    SNAPSHOT,           // checksum
+    COMMIT
+};
+
+// One change read from a feed; the fields that are not part of the change are left empty
+struct Feed_change {
+    Feed_op op = Feed_op::COMMIT;
+    int ID = 0;
+    int rating = 0;
+    std::string name;
+    std::string title;
+    unsigned long long checksum = 0;
+};
+
+// Return a checksum of the contents of a file. Throw Error exception if it cannot be read.
+unsigned long long file_checksum(const std::string& filename);
+
+// Writes changes to a feed, holding the changes of each command until the command is committed
+class Feed_writer {
+public:
+    // Open the feed at the given path, creating or emptying a file; opening a named pipe waits
+    // until a replica opens it too. Throw Error exception if it cannot be opened.
+    Feed_writer(const std::string& path);
+    ~Feed_writer();
+
+    Feed_writer(const Feed_writer&) = delete;
+    Feed_writer& operator=(const Feed_writer&) = delete;
+
+    // Add a change to those of the current command
+    void record_added(int ID, int rating, const std::string& medium, const std::string& title);
+    void record_deleted(int ID);
+    void rating_modified(int ID, int rating);
+    void title_modified(int ID, const std::string& title);
+    void collection_added(const std::string& name);
+    void collection_deleted(const std::string& name);
+    void member_added(const std::string& name, int ID);
+    void member_deleted(const std::string& name, int ID);
+    void library_cleared();
+    void catalog_cleared();
+    void all_cleared();
+    void snapshot_saved(unsigned long long checksum);
+
+    // Write the changes of the current command to the feed, if it made any.
+    // Throw Error exception if the feed cannot be written; after that, the feed is closed
+    // and changes are discarded.
+    void commit();
+
+    // The numbers of commands and changes written so far, and of bytes including the header
+    unsigned long long get_num_commits() const
+        { return num_commits; }
+    unsigned long long get_num_changes() const
+        { return num_changes; }
+    unsigned long long get_num_bytes() const
+        { return num_bytes; }
+
+private:
+    int fd;
+    // the encoded changes of the current command
+    std::string pending;
+    std::string change;
+    unsigned long long num_pending_changes = 0;
+    unsigned long long num_commits = 0, num_changes = 0, num_bytes = 0;
+
+    // Start encoding a change, add its fields, and add it to the pending changes
+    void begin_change(Feed_op op);
+    void add_number(unsigned long long number);
+    void add_string(const std::string& text);
+    void end_change();
+    // Write all of some bytes to the feed; return false if it fails
+    bool write_all(const std::string& bytes);
+};
+
+// Follows a feed on a separate thread, which keeps reading what is written to it
+class Feed_reader {
+public:
+    // Open the feed at the given path and start the thread that reads it; opening a named pipe
+    // waits until the primary opens it too. Throw Error exception if it cannot be opened.
+    Feed_reader(const std::string& path);
+    // Stop the reading thread and close the feed
+    ~Feed_reader();
+
+    Feed_reader(const Feed_reader&) = delete;
+    Feed_reader& operator=(const Feed_reader&) = delete;
+
+    // Return the changes of the commands committed to the feed since the last call, without their
+    // COMMIT changes, waiting up to the given number of milliseconds for one if there are none yet.
+    // Throw Error exception if the feed is invalid or cannot be read.
+    std::vector<Feed_change> take_changes(int wait_ms = 0);
+
+    // The numbers of commands and changes taken so far
+    unsigned long long get_num_commits() const
+        { return num_commits; }
+    unsigned long long get_num_changes() const
+        { return num_changes; }
+    // The number of bytes read but not taken yet
+    std::size_t get_num_waiting() const;
+
+private:
+    int fd;
+    std::thread reader;
+    std::atomic<bool> stopping;
+    mutable std::mutex received_mutex;
+    std::condition_variable committed;
+    // bytes read from the feed and not yet taken, the end of the last complete command among them,
+    // and how far they have been scanned for complete changes
+    std::string received;
+    std::size_t committed_end = 0;
+    std::size_t scanned_end = 0;
+    bool header_checked = false;
+    // why reading stopped, or nullptr while it goes on
+    const char* failure = nullptr;
+    unsigned long long num_commits = 0, num_changes = 0;
+
+    // Read the feed until stopped, waiting for more at its end
+    void read_feed();
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "ID_table.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <map>
+#include <vector>
+
+#include "Record.h"
+#include "Utility.h"
+
+using namespace std;
+
+// the window may always grow to this many slots
+const size_t min_window = 1024;
+// beyond min_window, the window may hold at most this many slots per Record
+const size_t max_slots_per_record = 4;
+
+// Return a pointer to the Record with the given ID, or nullptr if there is none
+Record* ID_table::find(int ID) const
+{
+    if (ID >= base && static_cast<size_t>(ID - base) < slots.size())
+    {
+        return slots[ID - base];
+    }
+    if (overflow.empty())
+    {
+        return nullptr;
+    }
+    auto overflow_it = overflow.find(ID);
+    return overflow_it == overflow.end() ? nullptr : overflow_it->second;
+}
+
+// Add the Record to the table.
+// Throw Error exception if the ID is not positive or is already in the table.
+void ID_table::insert(Record* record)
+{
+    int ID = record->get_ID();
+    if (ID < 1)
+    {
+        throw Error("Record ID is out of range!");
+    }
+    if (find(ID))
+    {
+        throw Error("Record ID is already in use!");
+    }
+    if (slots.empty())
+    {
+        base = ID;
+        slots.push_back(record);
+    }
+    else if (ID >= base && static_cast<size_t>(ID - base) < slots.size())
+    {
+        slots[ID - base] = record;
+    }
+    else if (ID > base)
+    {
+        size_t span = static_cast<size_t>(ID - base) + 1;
+        if (!dense_enough(span))
+        {
+            overflow[ID] = record;
+        }
+        else
+        {
+            slots.resize(span, nullptr);
+            slots[ID - base] = record;
+            take_in_overflow();
+        }
+    }
+    else
+    {
+        // grow the window downwards by at least its own size so that restoring
+        // Records in decreasing ID order does not shift the table every time
+        int new_base = max(1, min(ID, base - static_cast<int>(min(slots.size(), static_cast<size_t>(base)))));
+        size_t span = slots.size() + static_cast<size_t>(base - new_base);
+        if (!dense_enough(span))
+        {
+            overflow[ID] = record;
+        }
+        else
+        {
+            slots.insert(slots.begin(), static_cast<size_t>(base - new_base), nullptr);
+            base = new_base;
+            slots[ID - base] = record;
+            take_in_overflow();
+        }
+    }
+    ++num_records;
+}
+
+// Remove the Record with the given ID from the table; do nothing if there is none
+void ID_table::erase(int ID)
+{
+    if (ID >= base && static_cast<size_t>(ID - base) < slots.size())
+    {
+        if (!slots[ID - base])
+        {
+            return;
+        }
+        slots[ID - base] = nullptr;
+    }
+    else if (overflow.erase(ID) == 0)
+    {
+        return;
+    }
+    if (--num_records == 0)
+    {
+        clear();
+    }
+    else if (slots.size() > min_window && slots.size() > max_slots_per_record * num_records)
+    {
+        compact();
+    }
+}
+
+// Remove all Records from the table and release its memory
+void ID_table::clear()
+{
+    Record_container().swap(slots);
+    overflow.clear();
+    base = 1;
+    num_records = 0;
+}
+
+// Return true if the window may grow to span the given number of slots
+bool ID_table::dense_enough(size_t span) const
+{
+    return span <= min_window || span <= max_slots_per_record * (num_records + 1);
+}
+
+// Trim the tombstones at both ends of the window and release unused capacity
+void ID_table::compact()
+{
+    auto last_it = find_if(slots.rbegin(), slots.rend(), [](Record* record) { return record != nullptr; });
+    slots.erase(last_it.base(), slots.end());
+    auto first_it = find_if(slots.begin(), slots.end(), [](Record* record) { return record != nullptr; });
+    base += static_cast<int>(first_it - slots.begin());
+    slots.erase(slots.begin(), first_it);
+    slots.shrink_to_fit();
+}
+
+// Move the overflow Records whose IDs are now inside the window into their slots
+void ID_table::take_in_overflow()
+{
+    auto first_it = overflow.lower_bound(base);
+    auto last_it = overflow.lower_bound(base + static_cast<int>(slots.size()));
+    for_each(first_it, last_it, [this](const pair<const int, Record*>& entry) { slots[entry.first - base] = entry.second; });
+    overflow.erase(first_it, last_it);
+}
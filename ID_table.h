@@ -0,0 +1,67 @@
+#ifndef ID_TABLE_H
+#define ID_TABLE_H
+
+#include <cstddef>
+#include <functional>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Memory.h"
+#include "Record.h"
+
+/*
+An ID_table maps Record ID numbers to the Records that have them.
+Since new ID numbers are handed out in increasing order, the table is a vector of
+Record pointers indexed directly by ID (offset by the lowest ID in the window), which makes
+lookup, insertion, and removal constant time. Removing a Record leaves a null tombstone
+in its slot; runs of tombstones at either end of the window are compacted away once they
+make up most of the table.
+An ID far outside the window (such as one read in from a file) would make the window
+mostly tombstones, so such a Record is kept in a small ordered overflow map instead,
+until the window grows to take in its ID and it moves to its slot.
+*/
+
+class ID_table {
+
+public:
+    typedef int key_type;
+    typedef Record* value_type;
+
+    // Return a pointer to the Record with the given ID, or nullptr if there is none
+    Record* find(int ID) const;
+
+    // Add the Record to the table.
+    // Throw Error exception if the ID is not positive or is already in the table.
+    void insert(Record* record);
+
+    // Remove the Record with the given ID from the table; do nothing if there is none
+    void erase(int ID);
+
+    // Remove all Records from the table and release its memory
+    void clear();
+
+    std::size_t size() const
+        { return num_records; }
+
+    bool empty() const
+        { return num_records == 0; }
+
+private:
+    // slots[i] holds the Record with ID base + i, or nullptr if that ID is not in use
+    Record_container slots;
+    int base = 1;
+    std::size_t num_records = 0;
+    // Records whose IDs would have made the window too sparse
+    std::map<int, Record*, std::less<int>, Counting_allocator<std::pair<const int, Record*>, INDEX_MEMORY>> overflow;
+
+    // Return true if the window may grow to span the given number of slots
+    bool dense_enough(std::size_t span) const;
+    // Trim the tombstones at both ends of the window and release unused capacity
+    void compact();
+    // Move the overflow Records whose IDs are now inside the window into their slots
+    void take_in_overflow();
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "Ingest.h"
+
+#include <istream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <future>
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "Utility.h"
+
+using namespace std;
+
+// number of lines handed to a worker at a time
+const size_t lines_per_batch = 4096;
+
+// Parses one line into a record, leaving the title empty if the line is invalid
+Parsed_record parse_line(const string& line)
+{
+    Parsed_record parsed;
+    istringstream line_stream(line);
+    if (line_stream >> parsed.medium)
+    {
+        string raw_title;
+        getline(line_stream, raw_title);
+        parsed.title = parse_title(raw_title);
+    }
+    return parsed;
+}
+
+// Parses a chunk of lines into a batch of records in the same order
+Parsed_batch parse_lines(vector<string> lines)
+{
+    Parsed_batch batch;
+    batch.reserve(lines.size());
+    transform(lines.begin(), lines.end(), back_inserter(batch), parse_line);
+    return batch;
+}
+
+// Read lines from the stream until it ends, parsing them on up to num_workers worker threads at a time,
+// and call merge with each parsed batch in input order on the calling thread.
+// Exceptions thrown by merge are propagated after the outstanding workers finish.
+void ingest_records(istream& is, unsigned num_workers, const function<void (Parsed_batch&)>& merge)
+{
+    // each batch in flight has a worker thread of its own
+    size_t max_in_flight = max(1u, num_workers);
+    // batches being parsed, oldest first
+    deque<future<Parsed_batch>> in_flight;
+    auto merge_oldest = [&in_flight, &merge]()
+    {
+        Parsed_batch batch = in_flight.front().get();
+        in_flight.pop_front();
+        merge(batch);
+    };
+    while (is)
+    {
+        vector<string> lines;
+        lines.reserve(lines_per_batch);
+        string line;
+        while (lines.size() < lines_per_batch && getline(is, line))
+        {
+            lines.push_back(move(line));
+        }
+        if (lines.empty())
+        {
+            break;
+        }
+        if (in_flight.size() == max_in_flight)
+        {
+            merge_oldest();
+        }
+        in_flight.push_back(async(launch::async, parse_lines, move(lines)));
+    }
+    while (!in_flight.empty())
+    {
+        merge_oldest();
+    }
+}
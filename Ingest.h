@@ -0,0 +1,33 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <istream>
+#include <functional>
+
+#include <string>
+#include <vector>
+
+/*
+The ingest pipeline imports records from a stream with one record per line, in the same
+format as the arguments to the add record command: a medium followed by a title.
+Lines are read in chunks, and each chunk is parsed and its title normalized on a worker thread
+while later chunks are being read and earlier ones merged. The parsed chunks are handed
+to a single merge stage on the calling thread strictly in input order, so the outcome of an
+import never depends on how the worker threads were scheduled.
+*/
+
+// A record parsed from one line of input; the title is empty if the line was invalid
+struct Parsed_record {
+    std::string medium;
+    std::string title;
+};
+
+// A chunk of parsed records in input order
+typedef std::vector<Parsed_record> Parsed_batch;
+
+// Read lines from the stream until it ends, parsing them on up to num_workers worker threads at a time,
+// and call merge with each parsed batch in input order on the calling thread.
+// Exceptions thrown by merge are propagated after the outstanding workers finish.
+void ingest_records(std::istream& is, unsigned num_workers, const std::function<void (Parsed_batch&)>& merge);
+
+#endif
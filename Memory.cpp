@@ -0,0 +1,83 @@
+#include "Memory.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <initializer_list>
+#include <atomic>
+
+using namespace std;
+
+Memory_usage usage_by_category[NUM_MEMORY_CATEGORIES];
+Memory_usage usage_total;
+
+const char * const category_names[NUM_MEMORY_CATEGORIES] = {
+    "records", "title storage", "library indexes", "collection membership", "catalog"
+};
+
+// Record an allocation or release of memory in a category
+void memory_allocated(Memory_category category, size_t bytes)
+{
+    for (Memory_usage* usage : {&usage_by_category[category], &usage_total})
+    {
+        usage->live_bytes += bytes;
+        ++usage->allocations;
+        if (usage->live_bytes > usage->peak_bytes)
+        {
+            usage->peak_bytes = usage->live_bytes;
+        }
+    }
+}
+void memory_released(Memory_category category, size_t bytes)
+{
+    usage_by_category[category].live_bytes -= bytes;
+    usage_total.live_bytes -= bytes;
+}
+
+// Return the usage of one category, or of all categories together
+const Memory_usage& memory_usage(Memory_category category)
+{
+    return usage_by_category[category];
+}
+const Memory_usage& total_memory_usage()
+{
+    return usage_total;
+}
+
+// Return a printable name for a category
+const char* memory_category_name(Memory_category category)
+{
+    return category_names[category];
+}
+
+atomic<unsigned long long> heap_allocations{0};
+
+// Return the number of allocations made from the heap so far by all threads
+unsigned long long heap_allocation_count()
+{
+    return heap_allocations.load(memory_order_relaxed);
+}
+
+// The global allocation functions are replaced so that every heap allocation is counted;
+// the array and nothrow forms use these by default.
+void* operator new(size_t size)
+{
+    heap_allocations.fetch_add(1, memory_order_relaxed);
+    while (true)
+    {
+        if (void* p = malloc(size ? size : 1))
+        {
+            return p;
+        }
+        new_handler handler = get_new_handler();
+        if (!handler)
+        {
+            throw bad_alloc();
+        }
+        handler();
+    }
+}
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
@@ -0,0 +1,82 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstddef>
+#include <new>
+
+/*
+Memory accounting keeps a running count of the bytes and allocations used by each of the
+program's major data structures. Containers take part by using a Counting_allocator tagged with
+their category, and Record objects count themselves. Counting costs a few additions per
+allocation, so it is always on. The counts are not synchronized, so counted memory
+must only be allocated and released by the command thread.
+
+Separately, every allocation from the heap by any thread is counted, so that the number of
+allocations a command makes can be checked for copies that should not be there.
+*/
+
+enum Memory_category {
+    RECORD_MEMORY,      // Record objects
+    TITLE_MEMORY,       // Record title strings
+    INDEX_MEMORY,       // the library's title, ID, medium and rating indexes
+    MEMBERSHIP_MEMORY,  // the members of Collections
+    CATALOG_MEMORY,     // the catalog's tables of Collections
+    NUM_MEMORY_CATEGORIES
+};
+
+struct Memory_usage {
+    std::size_t live_bytes = 0;
+    std::size_t peak_bytes = 0;
+    std::size_t allocations = 0;
+};
+
+// Record an allocation or release of memory in a category
+void memory_allocated(Memory_category category, std::size_t bytes);
+void memory_released(Memory_category category, std::size_t bytes);
+
+// Return the usage of one category, or of all categories together
+const Memory_usage& memory_usage(Memory_category category);
+const Memory_usage& total_memory_usage();
+
+// Return a printable name for a category
+const char* memory_category_name(Memory_category category);
+
+// Return the number of allocations made from the heap so far by all threads
+unsigned long long heap_allocation_count();
+
+// A standard allocator that counts the memory it hands out under a category
+template<typename T, Memory_category Category>
+struct Counting_allocator {
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef Counting_allocator<U, Category> other;
+    };
+
+    Counting_allocator() = default;
+    template<typename U>
+    Counting_allocator(const Counting_allocator<U, Category>&) {}
+
+    T* allocate(std::size_t n)
+    {
+        T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+        memory_allocated(Category, n * sizeof(T));
+        return p;
+    }
+    void deallocate(T* p, std::size_t n)
+    {
+        memory_released(Category, n * sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template<typename T, typename U, Memory_category Category>
+bool operator==(const Counting_allocator<T, Category>&, const Counting_allocator<U, Category>&)
+    { return true; }
+
+template<typename T, typename U, Memory_category Category>
+bool operator!=(const Counting_allocator<T, Category>&, const Counting_allocator<U, Category>&)
+    { return false; }
+
+#endif
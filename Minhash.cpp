@@ -0,0 +1,81 @@
+#include "Minhash.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+using namespace std;
+
+// Mix the bits of a number so that every bit of the result depends on every bit of the number
+uint64_t mix_bits(uint64_t number)
+{
+    number += 0x9e3779b97f4a7c15ULL;
+    number = (number ^ (number >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    number = (number ^ (number >> 27)) * 0x94d049bb133111ebULL;
+    return number ^ (number >> 31);
+}
+
+// Update the signature for an ID joining the set.
+// The hash functions are h1 + i * h2 for the two halves h1 and h2 of one mixed hash of the ID,
+// which serve MinHash as well as independent hash functions at the cost of a single mixing.
+void Minhash_signature::add(int ID)
+{
+    uint64_t hash = mix_bits(static_cast<uint32_t>(ID));
+    uint32_t value = static_cast<uint32_t>(hash);
+    uint32_t step = static_cast<uint32_t>(hash >> 32) | 1;
+    for (int i = 0; i < MINHASH_VALUES; ++i, value += step)
+    {
+        values[i] = min(values[i], value);
+    }
+}
+
+// Update the signature for an ID leaving the set, marking it stale if the ID held one of its values
+void Minhash_signature::remove(int ID)
+{
+    uint64_t hash = mix_bits(static_cast<uint32_t>(ID));
+    uint32_t value = static_cast<uint32_t>(hash);
+    uint32_t step = static_cast<uint32_t>(hash >> 32) | 1;
+    for (int i = 0; i < MINHASH_VALUES && !stale; ++i, value += step)
+    {
+        stale = values[i] == value;
+    }
+}
+
+// Update the signature for the IDs of another set joining this one
+void Minhash_signature::merge(const Minhash_signature& other)
+{
+    for (int i = 0; i < MINHASH_VALUES; ++i)
+    {
+        values[i] = min(values[i], other.values[i]);
+    }
+    stale = stale || other.stale;
+}
+
+// Make this the signature of an empty set
+void Minhash_signature::clear()
+{
+    values.fill(UINT32_MAX);
+    stale = false;
+}
+
+// Return the estimated Jaccard similarity of the two sets, from 0 to 1
+double Minhash_signature::estimate_similarity(const Minhash_signature& other) const
+{
+    int num_equal = 0;
+    for (int i = 0; i < MINHASH_VALUES; ++i)
+    {
+        num_equal += values[i] == other.values[i];
+    }
+    return static_cast<double>(num_equal) / MINHASH_VALUES;
+}
+
+// Return the key of one band, which is different for each band as well as each set of values
+unsigned long long Minhash_signature::band_key(int band) const
+{
+    uint64_t key = mix_bits(band);
+    for (int row = 0; row < MINHASH_ROWS; ++row)
+    {
+        key = mix_bits(key ^ values[band * MINHASH_ROWS + row]);
+    }
+    return key;
+}
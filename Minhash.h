@@ -0,0 +1,72 @@
+#ifndef MINHASH_H
+#define MINHASH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*
+A MinHash signature summarizes a set of IDs so that the similarity of two sets, the size of
+their intersection over the size of their union (their Jaccard similarity), can be estimated
+from the signatures alone. The signature holds the smallest value of each of a fixed number
+of hash functions over the IDs in the set; two sets have the same smallest value for a hash
+function with probability equal to their similarity, so the fraction of values the signatures
+share estimates it.
+
+Adding an ID only lowers values, so a signature is kept up to date as IDs are added. Removing
+an ID can raise a value only if the ID held it, which cannot be undone without the rest of the
+set, so such a removal marks the signature stale and its owner rebuilds it from the set.
+
+For locality-sensitive hashing, the values are divided into bands of several values each, and
+each band is hashed to a key. Sets whose signatures share a band key are likely to be similar,
+so looking up the sets with the same band keys as a set finds candidates for its most similar
+sets without comparing it to every set.
+*/
+
+// The number of hash functions in a signature, made up of this many bands of this many values.
+// Sets are likely to share a band once their similarity passes about (1 / bands) ^ (1 / rows), here 0.18.
+const int MINHASH_BANDS = 32;
+const int MINHASH_ROWS = 2;
+const int MINHASH_VALUES = MINHASH_BANDS * MINHASH_ROWS;
+
+class Minhash_signature {
+public:
+    // Construct the signature of an empty set
+    Minhash_signature()
+        { clear(); }
+
+    // Update the signature for an ID joining the set
+    void add(int ID);
+    // Update the signature for an ID leaving the set, marking it stale if the ID held one of its values
+    void remove(int ID);
+    // Update the signature for the IDs of another set joining this one
+    void merge(const Minhash_signature& other);
+    // Make this the signature of an empty set
+    void clear();
+
+    // Make this the signature of the IDs given by key(*it) for each it in [first, last)
+    template<typename Iterator, typename Key>
+    void rebuild(Iterator first, Iterator last, Key key)
+    {
+        clear();
+        for (; first != last; ++first)
+        {
+            add(key(*first));
+        }
+    }
+
+    // True if an ID was removed that held a value, so the signature must be rebuilt before it is used
+    bool is_stale() const
+        { return stale; }
+
+    // Return the estimated Jaccard similarity of the two sets, from 0 to 1
+    double estimate_similarity(const Minhash_signature& other) const;
+    // Return the key of one band, which is different for each band as well as each set of values
+    unsigned long long band_key(int band) const;
+
+private:
+    std::array<std::uint32_t, MINHASH_VALUES> values;
+    bool stale;
+};
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef MULTI_INDEX_H
+#define MULTI_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+
+/*
+A Multi_index holds a set of values, such as Record pointers, under several indexes at once,
+each ordering or grouping the values in its own way. A value is stored once in each index,
+and a single insert or erase updates every index, so they always hold the same values.
+The indexes are given as template parameters and accessed by their position with get<N>(),
+so adding another index to a container is just a matter of declaring it.
+
+Each index class provides:
+    value_type          - the type of value held
+    insert(value)       - add a value; if this throws, the index is unchanged
+    insert(first, last) - add a range of values; if this throws, the index is unchanged
+    erase(value)        - remove a value if it is present; never throws
+    clear()             - remove all values
+along with whatever lookups suit it. Three kinds of index are provided here:
+a Sorted_index keeps the values in order in a random-access container,
+a Table_index keeps them in a table that looks values up by a key taken from each value,
+and a Grouped_index keeps them in groups with the same key, in a map from key to group.
+The indexes do not own the values; the values must outlive their time in the container.
+*/
+
+// A list of index positions, and a way to make the list 0, 1, ..., N - 1
+template<std::size_t... Ns>
+struct Index_list {};
+
+template<std::size_t N, std::size_t... Ns>
+struct Make_index_list : Make_index_list<N - 1, N - 1, Ns...> {};
+
+template<std::size_t... Ns>
+struct Make_index_list<0, Ns...> {
+    typedef Index_list<Ns...> type;
+};
+
+template<typename... Indexes>
+class Multi_index {
+public:
+    typedef typename std::tuple_element<0, std::tuple<Indexes...>>::type::value_type value_type;
+    // The type of the index in position N
+    template<std::size_t N>
+    using index_type = typename std::tuple_element<N, std::tuple<Indexes...>>::type;
+
+    // Return the index in position N
+    template<std::size_t N>
+    index_type<N>& get()
+        { return std::get<N>(indexes); }
+    template<std::size_t N>
+    const index_type<N>& get() const
+        { return std::get<N>(indexes); }
+
+    // Add a value to every index. If this throws, no index is changed.
+    void insert(const value_type& value)
+        { insert_into(value, All_indexes()); }
+
+    // Add a range of values to every index. If this throws, no index is changed.
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last)
+        { insert_range_into(first, last, All_indexes()); }
+
+    // Remove a value from every index
+    void erase(const value_type& value)
+        { erase_from(value, All_indexes()); }
+
+    /* Change a value in place with modifier, which is called with the value, and move the value to its new
+     * place in the indexes listed in Affected, or in every index if none are listed. Only the indexes whose
+     * order depends on what the modifier changes need be listed. If the modifier throws, it must leave the value
+     * unchanged, and the value is put back where it was. Putting a value back into an index can itself fail,
+     * since the index may need memory to hold it again; if it does, whether after the modifier threw or not,
+     * the value is removed from every index and that exception is passed on. A caller that must keep the value
+     * in the container should do whatever may fail before calling modify, with a modifier that cannot throw.
+     */
+    template<std::size_t... Affected, typename Modifier>
+    void modify(const value_type& value, Modifier modifier)
+    {
+        typedef typename std::conditional<sizeof...(Affected) == 0, All_indexes, Index_list<Affected...>>::type Reindexed;
+        erase_from(value, Reindexed());
+        try
+        {
+            modifier(value);
+        } catch (...)
+        {
+            reinsert_into(value, Reindexed());
+            throw;
+        }
+        reinsert_into(value, Reindexed());
+    }
+
+    // Remove all values from every index
+    void clear()
+        { clear_indexes(All_indexes()); }
+
+    // The number of values, which every index has
+    std::size_t size() const
+        { return std::get<0>(indexes).size(); }
+    bool empty() const
+        { return std::get<0>(indexes).empty(); }
+
+private:
+    typedef typename Make_index_list<sizeof...(Indexes)>::type All_indexes;
+
+    std::tuple<Indexes...> indexes;
+
+    // Insert into the listed indexes in order, removing the value from those already done if one fails
+    void insert_into(const value_type&, Index_list<>) {}
+    template<std::size_t First, std::size_t... Rest>
+    void insert_into(const value_type& value, Index_list<First, Rest...>)
+    {
+        std::get<First>(indexes).insert(value);
+        try
+        {
+            insert_into(value, Index_list<Rest...>());
+        } catch (...)
+        {
+            std::get<First>(indexes).erase(value);
+            throw;
+        }
+    }
+
+    // Insert a value taken out of the listed indexes back into them, or if that fails, remove it from every index
+    template<std::size_t... Listed>
+    void reinsert_into(const value_type& value, Index_list<Listed...> listed)
+    {
+        try
+        {
+            insert_into(value, listed);
+        } catch (...)
+        {
+            erase_from(value, All_indexes());
+            throw;
+        }
+    }
+
+    template<typename Iterator>
+    void insert_range_into(Iterator, Iterator, Index_list<>) {}
+    template<typename Iterator, std::size_t First, std::size_t... Rest>
+    void insert_range_into(Iterator first, Iterator last, Index_list<First, Rest...>)
+    {
+        std::get<First>(indexes).insert(first, last);
+        try
+        {
+            insert_range_into(first, last, Index_list<Rest...>());
+        } catch (...)
+        {
+            std::for_each(first, last, [this](const value_type& value) { std::get<First>(indexes).erase(value); });
+            throw;
+        }
+    }
+
+    void erase_from(const value_type&, Index_list<>) {}
+    template<std::size_t First, std::size_t... Rest>
+    void erase_from(const value_type& value, Index_list<First, Rest...>)
+    {
+        std::get<First>(indexes).erase(value);
+        erase_from(value, Index_list<Rest...>());
+    }
+
+    void clear_indexes(Index_list<>) {}
+    template<std::size_t First, std::size_t... Rest>
+    void clear_indexes(Index_list<First, Rest...>)
+    {
+        std::get<First>(indexes).clear();
+        clear_indexes(Index_list<Rest...>());
+    }
+};
+
+// An index that keeps the values sorted by Compare in a random-access Container, with no two equivalent.
+// Lookups take a probe value that compares like the value being looked for.
+template<typename Container, typename Compare>
+class Sorted_index {
+public:
+    typedef typename Container::value_type value_type;
+    typedef typename Container::const_iterator const_iterator;
+
+    // Add a value, which must not be equivalent to one already present
+    void insert(const value_type& value)
+        { elements.insert(lower_bound(value), value); }
+
+    // Add a range of values, none equivalent to one already present or to each other
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last)
+    {
+        elements.reserve(elements.size() + std::distance(first, last));
+        // with room reserved, nothing below can throw; merging the sorted range in is linear,
+        // where inserting the values one at a time would be quadratic
+        auto old_end = elements.insert(elements.end(), first, last);
+        std::sort(old_end, elements.end(), Compare());
+        std::inplace_merge(elements.begin(), old_end, elements.end(), Compare());
+    }
+
+    // Remove a value if it is present
+    void erase(const value_type& value)
+    {
+        auto value_it = std::lower_bound(elements.begin(), elements.end(), value, Compare());
+        if (value_it != elements.end() && *value_it == value)
+        {
+            elements.erase(value_it);
+        }
+    }
+
+    void clear()
+        { elements.clear(); }
+
+    // Return the first value not before the probe
+    const_iterator lower_bound(const value_type& probe) const
+        { return std::lower_bound(elements.begin(), elements.end(), probe, Compare()); }
+    // Return the value equivalent to the probe, or end() if there is none
+    const_iterator find(const value_type& probe) const
+    {
+        const_iterator value_it = lower_bound(probe);
+        return value_it == elements.end() || Compare()(probe, *value_it) ? elements.end() : value_it;
+    }
+
+    const_iterator begin() const
+        { return elements.begin(); }
+    const_iterator end() const
+        { return elements.end(); }
+    std::size_t size() const
+        { return elements.size(); }
+    bool empty() const
+        { return elements.empty(); }
+    // The sorted values themselves
+    const Container& get_elements() const
+        { return elements; }
+
+private:
+    Container elements;
+};
+
+// An index that keeps the values in a Table, which holds values under a key given by Key_extractor.
+// Table must provide find(key), returning the value or a null value, insert(value), erase(key), clear() and size().
+template<typename Table, typename Key_extractor>
+class Table_index {
+public:
+    typedef typename Table::value_type value_type;
+    typedef typename Table::key_type key_type;
+
+    // Add a value; the table decides what to do with a duplicate key
+    void insert(const value_type& value)
+        { table.insert(value); }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last)
+    {
+        for (Iterator value_it = first; value_it != last; ++value_it)
+        {
+            try
+            {
+                table.insert(*value_it);
+            } catch (...)
+            {
+                std::for_each(first, value_it, [this](const value_type& value) { erase(value); });
+                throw;
+            }
+        }
+    }
+
+    // Remove a value if it is present
+    void erase(const value_type& value)
+    {
+        key_type key = Key_extractor()(value);
+        if (table.find(key) == value)
+        {
+            table.erase(key);
+        }
+    }
+
+    void clear()
+        { table.clear(); }
+
+    // Return the value with the given key, or a null value if there is none
+    value_type find(const key_type& key) const
+        { return table.find(key); }
+
+    std::size_t size() const
+        { return table.size(); }
+    bool empty() const
+        { return table.size() == 0; }
+
+private:
+    Table table;
+};
+
+// An index that keeps the values in groups of values with the same key, given by Key_extractor.
+// Map is an associative container from key to group, and each group is a set of values; a group is
+// dropped once it is empty, so every group in the index has at least one value.
+template<typename Map, typename Key_extractor>
+class Grouped_index {
+public:
+    typedef typename Map::mapped_type group_type;
+    typedef typename group_type::value_type value_type;
+    typedef typename Map::key_type key_type;
+    typedef typename Map::const_iterator const_iterator;
+
+    // Add a value to the group for its key, making the group if there is none
+    void insert(const value_type& value)
+    {
+        const key_type& key = Key_extractor()(value);
+        auto group_it = groups.find(key);
+        if (group_it == groups.end())
+        {
+            group_it = groups.insert(typename Map::value_type(key, group_type())).first;
+        }
+        try
+        {
+            group_it->second.insert(value);
+        } catch (...)
+        {
+            if (group_it->second.empty())
+            {
+                groups.erase(group_it);
+            }
+            throw;
+        }
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last)
+    {
+        for (Iterator value_it = first; value_it != last; ++value_it)
+        {
+            try
+            {
+                insert(*value_it);
+            } catch (...)
+            {
+                std::for_each(first, value_it, [this](const value_type& value) { erase(value); });
+                throw;
+            }
+        }
+    }
+
+    // Remove a value if it is present, dropping its group once it is empty
+    void erase(const value_type& value)
+    {
+        auto group_it = groups.find(Key_extractor()(value));
+        if (group_it == groups.end())
+        {
+            return;
+        }
+        auto value_it = group_it->second.find(value);
+        if (value_it != group_it->second.end() && *value_it == value)
+        {
+            group_it->second.erase(value_it);
+        }
+        if (group_it->second.empty())
+        {
+            groups.erase(group_it);
+        }
+    }
+
+    void clear()
+        { groups.clear(); }
+
+    // Return the group for a key, or end() if there is none
+    const_iterator find(const key_type& key) const
+        { return groups.find(key); }
+    // Return the first group whose key is not before, or is after, the given key
+    const_iterator lower_bound(const key_type& key) const
+        { return groups.lower_bound(key); }
+    const_iterator upper_bound(const key_type& key) const
+        { return groups.upper_bound(key); }
+
+    const_iterator begin() const
+        { return groups.begin(); }
+    const_iterator end() const
+        { return groups.end(); }
+    // The number of groups
+    std::size_t size() const
+        { return groups.size(); }
+    bool empty() const
+        { return groups.empty(); }
+
+private:
+    Map groups;
+};
+
+#endif
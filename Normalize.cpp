@@ -0,0 +1,157 @@
+#include "Normalize.h"
+
+#include <cstddef>
+
+#include <vector>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define NORMALIZE_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+typedef size_t (*Normalize_function)(const char* in, size_t n, char* out);
+
+// Return true if the character is whitespace in the "C" locale: a space, or \t, \n, \v, \f or \r
+inline bool is_title_space(char c)
+{
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+// Normalize the characters from in up to end, writing them to out and returning the new end of out.
+// in_whitespace is true if the last character read was whitespace, or nothing has been written yet.
+inline char* normalize_chars(const char* in, const char* end, char* out, bool& in_whitespace)
+{
+    for (; in != end; ++in)
+    {
+        if (!is_title_space(*in))
+        {
+            *out++ = *in;
+            in_whitespace = false;
+        } else
+        {
+            if (!in_whitespace)
+            {
+                *out++ = ' ';
+            }
+            in_whitespace = true;
+        }
+    }
+    return out;
+}
+
+// Remove the trailing space, if any, and return the length of the title
+inline size_t finish_title(char* out_begin, char* out)
+{
+    if (out != out_begin && out[-1] == ' ')
+    {
+        --out;
+    }
+    return out - out_begin;
+}
+
+// Return true if a block can be copied unchanged, given which of its characters are whitespace
+// and which are spaces, and whether the character before it was whitespace
+inline bool block_is_normal(unsigned whitespace, unsigned spaces, bool in_whitespace)
+{
+    return whitespace == spaces && (whitespace & (whitespace >> 1)) == 0 && !(in_whitespace && (whitespace & 1));
+}
+
+size_t normalize_scalar(const char* in, size_t n, char* out)
+{
+    bool in_whitespace = true;
+    return finish_title(out, normalize_chars(in, in + n, out, in_whitespace));
+}
+
+#ifdef NORMALIZE_X86
+
+size_t normalize_sse2(const char* in, size_t n, char* out)
+{
+    const size_t block_size = 16;
+    const char* end = in + n;
+    char* out_begin = out;
+    bool in_whitespace = true;
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), control_range = _mm_set1_epi8('\r' - '\t');
+    for (; static_cast<size_t>(end - in) >= block_size; in += block_size)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        // a character is a control whitespace character if it is at most \r - \t above \t
+        __m128i above_tab = _mm_sub_epi8(block, tab);
+        __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(above_tab, control_range), above_tab);
+        unsigned spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(block, space));
+        unsigned whitespace = spaces | _mm_movemask_epi8(controls);
+        if (block_is_normal(whitespace, spaces, in_whitespace))
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+            out += block_size;
+            in_whitespace = (whitespace >> (block_size - 1)) & 1;
+        } else
+        {
+            out = normalize_chars(in, in + block_size, out, in_whitespace);
+        }
+    }
+    return finish_title(out_begin, normalize_chars(in, end, out, in_whitespace));
+}
+
+__attribute__((target("avx2")))
+size_t normalize_avx2(const char* in, size_t n, char* out)
+{
+    const size_t block_size = 32;
+    const char* end = in + n;
+    char* out_begin = out;
+    bool in_whitespace = true;
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), control_range = _mm256_set1_epi8('\r' - '\t');
+    for (; static_cast<size_t>(end - in) >= block_size; in += block_size)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+        __m256i above_tab = _mm256_sub_epi8(block, tab);
+        __m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(above_tab, control_range), above_tab);
+        unsigned spaces = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, space));
+        unsigned whitespace = spaces | static_cast<unsigned>(_mm256_movemask_epi8(controls));
+        if (block_is_normal(whitespace, spaces, in_whitespace))
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), block);
+            out += block_size;
+            in_whitespace = (whitespace >> (block_size - 1)) & 1;
+        } else
+        {
+            out = normalize_chars(in, in + block_size, out, in_whitespace);
+        }
+    }
+    return finish_title(out_begin, normalize_chars(in, end, out, in_whitespace));
+}
+
+#endif
+
+// Return the kernels that this processor supports, the simplest first
+vector<Normalize_kernel> supported_normalize_kernels()
+{
+    vector<Normalize_kernel> kernels {{"scalar", normalize_scalar}};
+#ifdef NORMALIZE_X86
+    kernels.push_back({"sse2", normalize_sse2});
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.push_back({"avx2", normalize_avx2});
+    }
+#endif
+    return kernels;
+}
+
+// Return the fastest kernel that this processor supports
+Normalize_function best_normalize_kernel()
+{
+#ifdef NORMALIZE_X86
+    return __builtin_cpu_supports("avx2") ? normalize_avx2 : normalize_sse2;
+#else
+    return normalize_scalar;
+#endif
+}
+
+// Normalize the n characters starting at in, writing the title to out, and return its length.
+// out must have room for n characters, and must not overlap in.
+size_t normalize_title(const char* in, size_t n, char* out)
+{
+    static const auto normalize = best_normalize_kernel();
+    return normalize(in, n, out);
+}
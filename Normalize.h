@@ -0,0 +1,31 @@
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#include <cstddef>
+
+#include <vector>
+
+/*
+Title normalization turns raw input into a title by removing leading and trailing whitespace
+and collapsing each run of whitespace inside it into a single space. Whitespace is what
+isspace recognizes in the "C" locale.
+Most titles are already normalized, so the vector kernels check a whole block of characters
+at a time and copy it unchanged if its whitespace is only single spaces that do not follow
+other whitespace; any other block is handled a character at a time. The fastest kernel
+the processor supports is chosen when the program starts.
+*/
+
+// Normalize the n characters starting at in, writing the title to out, and return its length.
+// out must have room for n characters, and must not overlap in.
+std::size_t normalize_title(const char* in, std::size_t n, char* out);
+
+// A kernel that normalize_title can use, for testing the kernels against each other
+struct Normalize_kernel {
+    const char* name;
+    std::size_t (*normalize)(const char* in, std::size_t n, char* out);
+};
+
+// Return the kernels that this processor supports, the simplest first
+std::vector<Normalize_kernel> supported_normalize_kernels();
+
+#endif
@@ -0,0 +1,176 @@
+#include "Output.h"
+
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <vector>
+
+using namespace std;
+
+// the size of each chunk, and how many chunks there are
+const size_t CHUNK_SIZE = 65536;
+const size_t NUM_CHUNKS = 4;
+// how many times an idle writer backs off, spinning and then yielding, before it sleeps until woken
+const int WRITER_SPIN_ATTEMPTS = 128;
+
+// Wait a little before checking the other side of the ring again: spin briefly,
+// then yield, then sleep for increasing times of up to a millisecond
+void back_off(int& attempts)
+{
+    ++attempts;
+    if (attempts <= 64)
+    {
+        return;
+    }
+    if (attempts <= 128)
+    {
+        this_thread::yield();
+        return;
+    }
+    int shift = attempts - 128 < 5 ? attempts - 128 : 5;
+    this_thread::sleep_for(chrono::microseconds(32 << shift));
+}
+
+// Start the writer thread, which writes to the destination
+Async_ostreambuf::Async_ostreambuf(streambuf* destination_) :
+    destination{destination_}, storage(CHUNK_SIZE * NUM_CHUNKS), chunk_sizes(NUM_CHUNKS)
+{
+    start_chunk();
+    writer = thread(&Async_ostreambuf::write_chunks, this);
+}
+
+// Write any remaining output and stop the writer thread
+Async_ostreambuf::~Async_ostreambuf()
+{
+    drain();
+    stopping.store(true);
+    wake_writer();
+    writer.join();
+}
+
+// Hand over everything written so far and wait until the writer has written it
+void Async_ostreambuf::drain()
+{
+    hand_off();
+    int attempts = 0;
+    while (chunks_written.load(memory_order_acquire) != chunks_published.load(memory_order_relaxed))
+    {
+        back_off(attempts);
+    }
+}
+
+Async_ostreambuf::int_type Async_ostreambuf::overflow(int_type c)
+{
+    hand_off();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int Async_ostreambuf::sync()
+{
+    hand_off();
+    return 0;
+}
+
+// Give the current chunk to the writer and start filling the next one,
+// waiting for the writer if every chunk is in use
+void Async_ostreambuf::hand_off()
+{
+    if (pptr() == pbase())
+    {
+        return;
+    }
+    size_t published = chunks_published.load(memory_order_relaxed);
+    chunk_sizes[published % NUM_CHUNKS] = pptr() - pbase();
+    chunks_published.store(published + 1);
+    wake_writer();
+    start_chunk();
+}
+
+// Point the put area at the slot for the next chunk to be published
+void Async_ostreambuf::start_chunk()
+{
+    size_t published = chunks_published.load(memory_order_relaxed);
+    int attempts = 0;
+    while (published - chunks_written.load(memory_order_acquire) == NUM_CHUNKS)
+    {
+        back_off(attempts);
+    }
+    char* chunk = &storage[(published % NUM_CHUNKS) * CHUNK_SIZE];
+    setp(chunk, chunk + CHUNK_SIZE);
+}
+
+// Write chunks as they are published until told to stop and everything has been written
+void Async_ostreambuf::write_chunks()
+{
+    size_t written = 0;
+    int attempts = 0;
+    while (true)
+    {
+        if (written == chunks_published.load(memory_order_acquire))
+        {
+            // the producer only stops after its last chunk has been written
+            if (stopping.load(memory_order_acquire))
+            {
+                return;
+            }
+            if (attempts < WRITER_SPIN_ATTEMPTS)
+            {
+                back_off(attempts);
+            } else
+            {
+                wait_for_chunk(written);
+            }
+            continue;
+        }
+        attempts = 0;
+        size_t slot = written % NUM_CHUNKS;
+        destination->sputn(&storage[slot * CHUNK_SIZE], chunk_sizes[slot]);
+        destination->pubsync();
+        chunks_written.store(++written, memory_order_release);
+    }
+}
+
+// Sleep until a chunk after the given number written is published or the writer is told to stop
+void Async_ostreambuf::wait_for_chunk(size_t written)
+{
+    unique_lock<mutex> lock(wait_mutex);
+    // writer_waiting is set before the checks, and the producer publishes before it reads writer_waiting,
+    // with both in sequentially consistent order, so either the checks see the chunk or the producer wakes the writer
+    writer_waiting.store(true);
+    chunk_ready.wait(lock, [this, written] { return chunks_published.load() != written || stopping.load(); });
+    writer_waiting.store(false);
+}
+
+// Wake the writer if it is asleep, after publishing a chunk or telling it to stop
+void Async_ostreambuf::wake_writer()
+{
+    if (writer_waiting.load())
+    {
+        // taking the lock means the writer is either waiting or has yet to check, and will see what was published
+        lock_guard<mutex> lock(wait_mutex);
+        chunk_ready.notify_one();
+    }
+}
+
+Async_output::Async_output(ostream& out_) : out{out_}, out_original{out_.rdbuf()}, async_buffer{out_original}
+{
+    out.rdbuf(&async_buffer);
+}
+
+Async_output::~Async_output()
+{
+    out.flush();
+    async_buffer.drain();
+    out.rdbuf(out_original);
+}
@@ -0,0 +1,94 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <vector>
+
+/*
+Asynchronous output lets command processing continue while earlier output is still being
+written, so a slow reader on the other end of a pipe does not stall the commands.
+Output is collected directly in one of a fixed number of chunk buffers arranged as a ring.
+When a chunk fills up, or the stream is flushed (which happens at every prompt, since the
+input stream is tied to the output stream), the chunk is handed to a writer thread that
+writes it to the original destination in order, and output continues in the next chunk.
+The ring has a single producer and a single consumer, so the hand-off needs no locks.
+When there is nothing to write, the writer spins briefly in case more output follows at once,
+and then sleeps on a condition variable until the producer hands off a chunk or stops; the
+producer only takes the lock to wake the writer when it is asleep.
+If every chunk is waiting to be written, the producer waits for the writer, which bounds
+the memory used and slows the commands down to the speed of the reader.
+*/
+
+// An output stream buffer that writes its output to another one on a separate thread
+class Async_ostreambuf : public std::streambuf {
+public:
+    // Start the writer thread, which writes to the destination
+    Async_ostreambuf(std::streambuf* destination_);
+    // Write any remaining output and stop the writer thread
+    ~Async_ostreambuf();
+
+    Async_ostreambuf(const Async_ostreambuf&) = delete;
+    Async_ostreambuf& operator=(const Async_ostreambuf&) = delete;
+
+    // Hand over everything written so far and wait until the writer has written it
+    void drain();
+
+protected:
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+private:
+    std::streambuf* destination;
+    // the chunk buffers, one after another, and how much of each is filled
+    std::vector<char> storage;
+    std::vector<std::size_t> chunk_sizes;
+    // the number of chunks handed over by the producer and written by the writer so far;
+    // chunk i is in slot i % number of slots
+    std::atomic<std::size_t> chunks_published{0};
+    std::atomic<std::size_t> chunks_written{0};
+    std::atomic<bool> stopping{false};
+    // set while the writer is asleep, or about to sleep, waiting for a chunk
+    std::atomic<bool> writer_waiting{false};
+    std::mutex wait_mutex;
+    std::condition_variable chunk_ready;
+    std::thread writer;
+
+    // Give the current chunk to the writer and start filling the next one,
+    // waiting for the writer if every chunk is in use
+    void hand_off();
+    // Point the put area at the slot for the next chunk to be published
+    void start_chunk();
+    // Write chunks as they are published until told to stop and everything has been written
+    void write_chunks();
+    // Sleep until a chunk after the given number written is published or the writer is told to stop
+    void wait_for_chunk(std::size_t written);
+    // Wake the writer if it is asleep, after publishing a chunk or telling it to stop
+    void wake_writer();
+};
+
+/*
+An Async_output installs an Async_ostreambuf on a stream for its lifetime,
+and on destruction writes out the remaining output and restores the stream's own buffer.
+*/
+class Async_output {
+public:
+    Async_output(std::ostream& out_);
+    ~Async_output();
+
+    Async_output(const Async_output&) = delete;
+    Async_output& operator=(const Async_output&) = delete;
+
+private:
+    std::ostream& out;
+    std::streambuf* out_original;
+    Async_ostreambuf async_buffer;
+};
+
+#endif
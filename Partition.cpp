@@ -0,0 +1,340 @@
+#include "Partition.h"
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <utility>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Capture.h"
+#include "Utility.h"
+
+using namespace std;
+
+const char * const WORKER_PROMPT = "\x1e\x1f";
+
+const char * WORKER_FAILED_MSG = "A partition worker stopped unexpectedly!";
+const char * BAD_REPLY_MSG = "Invalid reply from a partition worker!";
+
+// the characters titles usually start with, in title order, which are shared out evenly until the shards are rebalanced
+const char * const TITLE_START_KEYS = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+const int NUM_TITLE_START_KEYS = 62;
+
+// Start the given number of worker processes. Each one calls serve with its standard input
+// and output connected to this process and exits with the value serve returns.
+// This must be done before the process starts any other threads.
+// Throw Error exception if the workers could not be started.
+Partition::Partition(int num_shards, const function<int()>& serve)
+{
+    for (int shard = 1; shard < num_shards; ++shard)
+    {
+        boundaries.push_back(string(1, TITLE_START_KEYS[shard * NUM_TITLE_START_KEYS / num_shards]));
+    }
+    for (int shard = 0; shard < num_shards; ++shard)
+    {
+        int input_pipe[2], output_pipe[2];
+        if (pipe(input_pipe) != 0 || pipe(output_pipe) != 0)
+        {
+            throw Error("Could not create pipes!");
+        }
+        Worker worker;
+        worker.pid = fork();
+        if (worker.pid < 0)
+        {
+            throw Error("Could not start a partition worker!");
+        }
+        if (worker.pid == 0)
+        {
+            dup2(input_pipe[0], STDIN_FILENO);
+            dup2(output_pipe[1], STDOUT_FILENO);
+            close(input_pipe[0]);
+            close(input_pipe[1]);
+            close(output_pipe[0]);
+            close(output_pipe[1]);
+            // the pipes to the workers started earlier belong to the coordinator alone
+            for (auto& other : workers)
+            {
+                close(other.to_worker);
+                close(other.from_worker);
+            }
+            int status = serve();
+            cout.flush();
+            _exit(status);
+        }
+        close(input_pipe[0]);
+        close(output_pipe[1]);
+        worker.to_worker = input_pipe[1];
+        worker.from_worker = output_pipe[0];
+        workers.push_back(worker);
+    }
+    // a worker that has died is detected when its pipe closes
+    signal(SIGPIPE, SIG_IGN);
+    // each worker starts by sending an empty reply
+    transfer(vector<string>(workers.size()), vector<size_t>(workers.size(), 1));
+}
+
+// Close the pipes to any workers still running and wait for them to exit
+Partition::~Partition()
+{
+    for_each(workers.begin(), workers.end(), [this](Worker& worker) { stop_worker(worker); });
+}
+
+// Return the shard that holds the given title
+int Partition::shard_for_title(const string& title) const
+{
+    return static_cast<int>(upper_bound(boundaries.begin(), boundaries.end(), title) - boundaries.begin());
+}
+
+// Return the first and last of the shards that hold the titles starting with the given prefix
+pair<int, int> Partition::shards_for_prefix(const string& prefix) const
+{
+    // the titles with the prefix run from the prefix itself to the last title that starts with it,
+    // so they reach every shard after the prefix's own whose boundary starts with the prefix
+    int first = shard_for_title(prefix);
+    auto last_it = find_if(boundaries.begin() + first, boundaries.end(),
+        [&prefix](const string& boundary) { return boundary.compare(0, prefix.size(), prefix) != 0; });
+    return make_pair(first, static_cast<int>(last_it - boundaries.begin()));
+}
+
+// Choose the range of each shard so that the given titles are shared out about evenly.
+// This must only be done while the shards hold no records.
+void Partition::rebalance(const vector<string>& titles)
+{
+    if (titles.empty())
+    {
+        return;
+    }
+    vector<string> sorted_titles(titles);
+    sort(sorted_titles.begin(), sorted_titles.end());
+    // a shard starts at the title that would be first in it if each held the same number
+    for (size_t shard = 1; shard < workers.size(); ++shard)
+    {
+        boundaries[shard - 1] = sorted_titles[shard * sorted_titles.size() / workers.size()];
+    }
+}
+
+// Send each shard its list of commands, all at once and to all shards together,
+// and return each shard's replies in order. Throw Error exception if a worker fails.
+vector<vector<Worker_reply>> Partition::exchange(const vector<vector<string>>& commands)
+{
+    vector<string> inputs(workers.size());
+    vector<size_t> expected(workers.size());
+    for (size_t shard = 0; shard < workers.size(); ++shard)
+    {
+        for (auto& command : commands[shard])
+        {
+            inputs[shard] += command;
+            inputs[shard] += '\n';
+        }
+        expected[shard] = commands[shard].size();
+    }
+    return transfer(inputs, expected);
+}
+
+// Send one command to one shard and return its reply
+Worker_reply Partition::ask(int shard, const string& command)
+{
+    vector<vector<string>> commands(workers.size());
+    commands[shard].push_back(command);
+    return exchange(commands)[shard].front();
+}
+
+// Send the same command to every shard and return the replies in shard order
+vector<Worker_reply> Partition::ask_all(const string& command)
+{
+    vector<vector<Worker_reply>> replies = exchange(vector<vector<string>>(workers.size(), vector<string>(1, command)));
+    vector<Worker_reply> first_replies;
+    for (auto& shard_replies : replies)
+    {
+        first_replies.push_back(move(shard_replies.front()));
+    }
+    return first_replies;
+}
+
+// Tell every worker to quit, discard what it prints, and wait for it to exit
+void Partition::quit()
+{
+    for (auto& worker : workers)
+    {
+        const char quit_command[] = "qq\n";
+        if (write(worker.to_worker, quit_command, sizeof(quit_command) - 1) > 0)
+        {
+            char buffer[4096];
+            while (read(worker.from_worker, buffer, sizeof(buffer)) > 0)
+            {
+            }
+        }
+        stop_worker(worker);
+    }
+    workers.clear();
+}
+
+// Write each worker its input while reading its output, until each one has sent
+// the expected number of replies, and return the replies
+vector<vector<Worker_reply>> Partition::transfer(const vector<string>& inputs, const vector<size_t>& expected)
+{
+    const string prompt = WORKER_PROMPT;
+    vector<vector<Worker_reply>> replies(workers.size());
+    vector<size_t> written(workers.size(), 0);
+    while (true)
+    {
+        // collect the complete replies that have arrived, and watch the workers that owe more
+        vector<pollfd> fds;
+        vector<size_t> fd_shards;
+        for (size_t shard = 0; shard < workers.size(); ++shard)
+        {
+            Worker& worker = workers[shard];
+            size_t prompt_pos;
+            while (replies[shard].size() < expected[shard] && (prompt_pos = worker.unread.find(prompt)) != string::npos
+                && prompt_pos + prompt.size() < worker.unread.size())
+            {
+                Worker_reply reply;
+                reply.output = worker.unread.substr(0, prompt_pos);
+                reply.result = static_cast<Result_class>(worker.unread[prompt_pos + prompt.size()]);
+                worker.unread.erase(0, prompt_pos + prompt.size() + 1);
+                replies[shard].push_back(move(reply));
+            }
+            if (replies[shard].size() < expected[shard])
+            {
+                fds.push_back({worker.from_worker, POLLIN, 0});
+                fd_shards.push_back(shard);
+            }
+            if (written[shard] < inputs[shard].size())
+            {
+                fds.push_back({worker.to_worker, POLLOUT, 0});
+                fd_shards.push_back(shard);
+            }
+        }
+        if (fds.empty())
+        {
+            return replies;
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw Error(WORKER_FAILED_MSG);
+        }
+        for (size_t i = 0; i < fds.size(); ++i)
+        {
+            Worker& worker = workers[fd_shards[i]];
+            size_t shard = fd_shards[i];
+            if (fds[i].events == POLLOUT && fds[i].revents)
+            {
+                // a pipe with room for output can always take PIPE_BUF bytes without blocking
+                size_t amount = min(inputs[shard].size() - written[shard], static_cast<size_t>(PIPE_BUF));
+                ssize_t num_written = write(worker.to_worker, inputs[shard].data() + written[shard], amount);
+                if (num_written <= 0)
+                {
+                    throw Error(WORKER_FAILED_MSG);
+                }
+                written[shard] += num_written;
+            } else if (fds[i].events == POLLIN && fds[i].revents)
+            {
+                char buffer[65536];
+                ssize_t num_read = read(worker.from_worker, buffer, sizeof(buffer));
+                if (num_read <= 0)
+                {
+                    throw Error(WORKER_FAILED_MSG);
+                }
+                worker.unread.append(buffer, num_read);
+            }
+        }
+    }
+}
+
+// Close the pipes to a worker and wait for it to exit
+void Partition::stop_worker(Worker& worker)
+{
+    close(worker.to_worker);
+    close(worker.from_worker);
+    int status;
+    waitpid(worker.pid, &status, 0);
+}
+
+// Split some output into its lines, without their newlines
+vector<string> split_lines(const string& output)
+{
+    vector<string> lines;
+    size_t line_start = 0, line_end;
+    while ((line_end = output.find('\n', line_start)) != string::npos)
+    {
+        lines.push_back(output.substr(line_start, line_end - line_start));
+        line_start = line_end + 1;
+    }
+    if (line_start < output.size())
+    {
+        lines.push_back(output.substr(line_start));
+    }
+    return lines;
+}
+
+// Parse a line describing a record. Throw Error exception if it is not in the right format.
+Record_line parse_record_line(const string& line)
+{
+    Record_line record;
+    record.text = line;
+    size_t colon = line.find(": ");
+    size_t medium_end = colon == string::npos ? string::npos : line.find(' ', colon + 2);
+    size_t rating_end = medium_end == string::npos ? string::npos : line.find(' ', medium_end + 1);
+    if (rating_end == string::npos)
+    {
+        throw Error(BAD_REPLY_MSG);
+    }
+    record.ID = atoi(line.substr(0, colon).c_str());
+    record.medium = line.substr(colon + 2, medium_end - colon - 2);
+    string rating = line.substr(medium_end + 1, rating_end - medium_end - 1);
+    record.rating = rating == "u" ? 0 : atoi(rating.c_str());
+    record.title = line.substr(rating_end + 1);
+    return record;
+}
+
+// Merge lists of record lines, each already sorted according to less, into one sorted list
+vector<Record_line> merge_record_lines(vector<vector<Record_line>>& sorted_lists,
+    const function<bool (const Record_line&, const Record_line&)>& less)
+{
+    // the heap holds the position of the next line of each list that has one left;
+    // its top is the position of the smallest of those lines
+    typedef pair<size_t, size_t> Position;
+    auto greater = [&sorted_lists, &less](const Position& a, const Position& b)
+        { return less(sorted_lists[b.first][b.second], sorted_lists[a.first][a.second]); };
+    priority_queue<Position, vector<Position>, decltype(greater)> next_lines(greater);
+    size_t total = 0;
+    for (size_t list = 0; list < sorted_lists.size(); ++list)
+    {
+        if (!sorted_lists[list].empty())
+        {
+            next_lines.push(Position(list, 0));
+        }
+        total += sorted_lists[list].size();
+    }
+    vector<Record_line> merged;
+    merged.reserve(total);
+    while (!next_lines.empty())
+    {
+        Position position = next_lines.top();
+        next_lines.pop();
+        merged.push_back(move(sorted_lists[position.first][position.second]));
+        if (++position.second < sorted_lists[position.first].size())
+        {
+            next_lines.push(position);
+        }
+    }
+    return merged;
+}
@@ -0,0 +1,117 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <cstddef>
+#include <functional>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "Capture.h"
+
+/*
+A Partition splits the library across several local worker processes by title. Each shard
+holds a range of titles in title order, starting at its boundary title, so every title has a
+shard; titles sharing a prefix are in one range, which may span several shards. At first the
+boundaries are single characters, sharing out the digits and the upper and lower case letters
+evenly. When a whole library is loaded, the boundaries are chosen again from the quantiles of
+its titles, so that each shard holds about the same number of records however the titles
+start. Each worker is a copy of this program running the normal command loop on its own part
+of the library, connected to the coordinating process through pipes.
+
+A worker marks the end of each command's output with WORKER_PROMPT followed by the
+Result_class character of the command, in place of the usual prompt, so the coordinator
+knows where each reply ends and whether it was an error. The worker greets the coordinator
+with one such prompt when it starts.
+*/
+
+extern const char * const WORKER_PROMPT;
+
+// the most shards a library can be split into
+const int MAX_SHARDS = 36;
+
+// The output of one command run by a worker, and how it finished
+struct Worker_reply {
+    std::string output;
+    Result_class result = Result_class::OK;
+};
+
+// A line of output describing a record, in the format Record's output operator uses
+struct Record_line {
+    std::string text;
+    int ID = 0;
+    std::string medium;
+    int rating = 0;
+    std::string title;
+};
+
+class Partition {
+public:
+    // Start the given number of worker processes. Each one calls serve with its standard input
+    // and output connected to this process and exits with the value serve returns.
+    // This must be done before the process starts any other threads.
+    // Throw Error exception if the workers could not be started.
+    Partition(int num_shards, const std::function<int()>& serve);
+    // Close the pipes to any workers still running and wait for them to exit
+    ~Partition();
+
+    Partition(const Partition&) = delete;
+    Partition& operator=(const Partition&) = delete;
+
+    int size() const
+        { return static_cast<int>(workers.size()); }
+
+    // Return the shard that holds the given title
+    int shard_for_title(const std::string& title) const;
+    // Return the first and last of the shards that hold the titles starting with the given prefix
+    std::pair<int, int> shards_for_prefix(const std::string& prefix) const;
+    // Choose the range of each shard so that the given titles are shared out about evenly.
+    // This must only be done while the shards hold no records.
+    void rebalance(const std::vector<std::string>& titles);
+
+    // Send each shard its list of commands, all at once and to all shards together,
+    // and return each shard's replies in order. Throw Error exception if a worker fails.
+    std::vector<std::vector<Worker_reply>> exchange(const std::vector<std::vector<std::string>>& commands);
+    // Send one command to one shard and return its reply
+    Worker_reply ask(int shard, const std::string& command);
+    // Send the same command to every shard and return the replies in shard order
+    std::vector<Worker_reply> ask_all(const std::string& command);
+
+    // Tell every worker to quit, discard what it prints, and wait for it to exit
+    void quit();
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int to_worker = -1;
+        int from_worker = -1;
+        // output read from the worker that is not part of a complete reply yet
+        std::string unread;
+    };
+
+    std::vector<Worker> workers;
+    // the first title held by each shard after the first, in title order
+    std::vector<std::string> boundaries;
+
+    // Write each worker its input while reading its output, until each one has sent
+    // the expected number of replies, and return the replies
+    std::vector<std::vector<Worker_reply>> transfer(const std::vector<std::string>& inputs,
+        const std::vector<std::size_t>& expected);
+    // Close the pipes to a worker and wait for it to exit
+    void stop_worker(Worker& worker);
+};
+
+// Split some output into its lines, without their newlines
+std::vector<std::string> split_lines(const std::string& output);
+
+// Parse a line describing a record. Throw Error exception if it is not in the right format.
+Record_line parse_record_line(const std::string& line);
+
+// Merge lists of record lines, each already sorted according to less, into one sorted list
+std::vector<Record_line> merge_record_lines(std::vector<std::vector<Record_line>>& sorted_lists,
+    const std::function<bool (const Record_line&, const Record_line&)>& less);
+
+#endif
@@ -1,28 +1,50 @@
 #include "Record.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <cctype>
-#include <iostream>
 
 #include <string>
 
+#include "Memory.h"
+#include "Title_store.h"
 #include "Utility.h"
 
 using namespace std;
 
 const int rating_min = 1;
 const int rating_max = 5;
-int Record::ID_counter = 0;
+atomic<int> Record::ID_counter{0};
 int Record::ID_backup = 0;
+Title_store* Record::title_store = nullptr;
 
 // Create a Record object, giving it a unique ID number by first incrementing
 // a static member variable then using its value as the ID number. The rating is set to 0.
-Record::Record(const string &medium_, const string &title_) : title{title_}, medium{medium_}, rating{0}
+Record::Record(const string &medium_, const string &title_) :
+    title{title_.data(), kept_title_size(title_.size())}, medium{medium_}, rating{0}
 {
+    if (title.size() < title_.size())
+    {
+        title_block = title_store->add(title_.data(), title_.size());
+    }
     ID = ++ID_counter;
 }
 
+// Create a Record object with an ID number previously obtained from reserve_IDs.
+// The static member variable is not modified. The rating is set to 0.
+Record::Record(int ID_, const string &medium_, const string &title_) :
+    title{title_.data(), kept_title_size(title_.size())}, medium{medium_}, ID{ID_}, rating{0}
+{
+    if (title.size() < title_.size())
+    {
+        title_block = title_store->add(title_.data(), title_.size());
+    }
+}
+
 // Construct a Record object from a file stream in save format.
 // Throw Error exception if invalid data discovered in file.
 // No check made for whether the Record already exists or not.
@@ -44,30 +66,148 @@ Record::Record(ifstream &is)
     {
         throw Error(FILE_ERROR_MSG);
     }
-    getline(is, title);
+    if (!title_store)
+    {
+        getline(is, title);
+        return;
+    }
+    string full_title;
+    getline(is, full_title);
+    Staged_title staged = stage_title(full_title);
+    set_title(staged);
+}
+
+// Record objects count their own memory
+void* Record::operator new(size_t size)
+{
+    void* p = ::operator new(size);
+    memory_allocated(RECORD_MEMORY, size);
+    return p;
+}
+void Record::operator delete(void* p, size_t size)
+{
+    memory_released(RECORD_MEMORY, size);
+    ::operator delete(p);
 }
 
 // if the rating is not between 1 and 5 inclusive, an exception is thrown
-void Record::set_rating(int rating_)
+void Record::check_rating(int rating_)
 {
     if (rating_ < rating_min || rating_ > rating_max)
     {
         throw Error("Rating is out of range!");
     }
+}
+void Record::set_rating(int rating_)
+{
+    check_rating(rating_);
     rating = rating_;
 }
 
-// changes the title of a Record
-void Record::set_title(string title_)
+// Make a title ready to be put in place. Throw Error exception if the title store cannot take it.
+Record::Staged_title Record::stage_title(const string& title_)
+{
+    Staged_title staged;
+    staged.title = Title_string(title_.data(), kept_title_size(title_.size()));
+    if (staged.title.size() < title_.size())
+    {
+        staged.title_block = title_store->add(title_.data(), title_.size());
+    }
+    return staged;
+}
+
+// Put a staged title in place, leaving the old title in staged so that it can be put back the same way
+void Record::set_title(Staged_title& staged)
 {
-    title = title_;
+    // a title replaced here stays in the title store, which is only ever appended to
+    title.swap(staged.title);
+    swap(title_block, staged.title_block);
+}
+
+string Record::get_title() const
+{
+    string full_title;
+    copy_title(full_title);
+    return full_title;
+}
+
+// Compare part of the title with a string, as std::string::compare does, without copying the title
+int Record::compare_title(size_t pos, size_t len, const string& other) const
+{
+    // the prefix settles the comparison if the part compared is all in it, or if it differs from other
+    if (!title_block || (len != string::npos && pos + len <= title.size()))
+    {
+        return title.compare(pos, len, other.data(), other.size());
+    }
+    if (pos == 0)
+    {
+        size_t common = min(title.size(), other.size());
+        int result = title.compare(0, common, other.data(), common);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+    string full_title;
+    copy_title(full_title);
+    return full_title.compare(pos, len, other);
+}
+
+// Copy the title into an existing string, reusing its storage
+void Record::copy_title(string& dest) const
+{
+    if (title_block)
+    {
+        title_store->get(title_block, dest);
+    } else
+    {
+        dest.assign(title.data(), title.size());
+    }
+}
+
+// Write the title to a stream, without copying it unless it is in the title store
+void Record::print_title(ostream& os) const
+{
+    if (title_block)
+    {
+        os << get_title();
+    } else
+    {
+        os << title;
+    }
+}
+
+// Compare the titles of two Records, at least one of which has its title in the title store
+int Record::compare_stored_titles(const Record& rhs) const
+{
+    // titles that differ within the shorter of the two prefixes are in the same order as the prefixes
+    size_t common = min(title.size(), rhs.title.size());
+    int result = title.compare(0, common, rhs.title.data(), common);
+    if (result != 0)
+    {
+        return result;
+    }
+    // the store compares the rest where the titles are, fetching only those not in memory
+    if (!rhs.title_block)
+    {
+        return title_store->compare(title_block, rhs.title.data(), rhs.title.size(), common);
+    }
+    if (!title_block)
+    {
+        // the store compares the other way round, so the sign is reversed
+        int rhs_result = title_store->compare(rhs.title_block, title.data(), title.size(), common);
+        return (rhs_result < 0) - (rhs_result > 0);
+    }
+    return title_store->compare(title_block, rhs.title_block, common);
 }
 
 // Write a Record's data to a stream in save format with final endl.
 // The record number is saved.
 void Record::save(ostream &os) const
 {
-    os << ID << " " << medium << " " << rating << " " << title << "\n";
+    os << ID << " " << medium << " " << rating << " ";
+    print_title(os);
+    os << "\n";
 }
 
 // Print a Record's data to the stream without a final endl.
@@ -78,7 +218,8 @@ ostream& operator<< (ostream& os, const Record& record)
     os << record.ID << ": " << record.medium << " ";
     if (record.rating == 0) os << 'u';
     else os << record.rating;
-    os << " " << record.title;
+    os << " ";
+    record.print_title(os);
     return os;
 }
 
@@ -1,17 +1,32 @@
 #ifndef RECORD_H
 #define RECORD_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <ostream>
 
 #include <string>
+#include <vector>
+
+#include "Memory.h"
+
+class Title_store;
 
 /*
 A Record contains a unique ID number, a rating, and a title and medium name as std::strings.
 When created, a Record is assigned a unique ID number. The first Record created
 has ID number == 1.
+
+When Records are given a Title_store, a title longer than TITLE_PREFIX_LENGTH is kept in the
+store, and the Record holds only its first TITLE_PREFIX_LENGTH characters, which fit in the
+string without allocating. Titles are compared by their prefixes where those differ, and
+fetched from the store otherwise, or when they are copied or printed.
 */
 
+const std::size_t TITLE_PREFIX_LENGTH = 15;
+
 class Record {
 
 public:
@@ -19,9 +34,14 @@ public:
     // a static member variable then using its value as the ID number. The rating is set to 0.
     Record(const std::string &medium_, const std::string &title_);
 
+    // Create a Record object with an ID number previously obtained from reserve_IDs.
+    // The static member variable is not modified. The rating is set to 0.
+    Record(int ID_, const std::string &medium_, const std::string &title_);
+
     // Create a Record object suitable for use as a probe containing the supplied
     // title. The ID and rating are set to 0, and the medium is an empty std::string.
-    Record(const std::string &title_) : title{title_}, ID{0}, rating{0} {}
+    // A probe always holds its whole title.
+    Record(const std::string &title_) : title{title_.data(), title_.size()}, ID{0}, rating{0} {}
 
     // Create a Record object suitable for use as a probe containing the supplied
     // ID number - the static member variable is not modified.
@@ -43,52 +63,115 @@ public:
     Record &operator=(const Record &) = delete; // disallow copy assignment
     Record &operator=(Record &&) = delete; // disallow move assignment
 
+    // Record objects count their own memory
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p, std::size_t size);
+
     // Accessors
     int get_ID() const { return ID; }
 
-    std::string get_title() const { return title; }
+    std::string get_title() const;
+
+    const std::string& get_medium() const { return medium; }
+
+    // Compare part of the title with a string, as std::string::compare does, without copying the title
+    int compare_title(std::size_t pos, std::size_t len, const std::string& other) const;
+
+    // Copy the title into an existing string, reusing its storage
+    void copy_title(std::string& dest) const;
+
+    // Write the title to a stream, without copying it unless it is in the title store
+    void print_title(std::ostream& os) const;
 
     int get_rating() const { return rating; }
 
+    // The number of Collections in the catalog that have this Record as a member, maintained by Catalog
+    int get_membership_count() const { return membership_count; }
+    // Count one more or one fewer Collection membership and return the new count
+    int add_membership() { return ++membership_count; }
+    int remove_membership() { return --membership_count; }
+
     // reset the ID counter
     static void reset_ID_counter() { ID_counter = 0; }
 
+    // Reserve a block of consecutive ID numbers for new Records and return the first of them.
+    // Safe to call from any thread; the block is never handed out again until the counter is reset.
+    static int reserve_IDs(int count) { return ID_counter.fetch_add(count) + 1; }
+
     // save the ID counter in another static member variable
     static void save_ID_counter() { ID_backup = ID_counter; }
 
     // restore the ID counter from the value in the other static member variable
     static void restore_ID_counter() { ID_counter = ID_backup; }
 
+    // Keep the long titles of Records created from now on in a store, or in the Records if nullptr.
+    // The store must outlive those Records.
+    static void set_title_store(Title_store* store) { title_store = store; }
+    static Title_store* get_title_store() { return title_store; }
+
     // if the rating is not between 1 and 5 inclusive, an exception is thrown
+    static void check_rating(int rating_);
     void set_rating(int rating_);
 
-    // changes the title of a Record
-    void set_title(std::string title_);
+    // A new title for a Record, made by stage_title and put in place by set_title. Making it can fail,
+    // since a long title is added to the title store, but putting it in place cannot.
+    class Staged_title;
+    // Make a title ready to be put in place. Throw Error exception if the title store cannot take it.
+    static Staged_title stage_title(const std::string& title_);
+    // Put a staged title in place, leaving the old title in staged so that it can be put back the same way
+    void set_title(Staged_title& staged);
 
     // Write a Record's data to a stream in save format with final endl.
     // The record number is saved.
     void save(std::ostream &os) const;
 
     // This operator defines the order relation between Records, based just on the last title
-    bool operator<(const Record &rhs) const { return title < rhs.title; }
+    bool operator<(const Record &rhs) const
+        { return (!title_block && !rhs.title_block) ? title < rhs.title : compare_stored_titles(rhs) < 0; }
 
     // Record equality operator, checks both title and ID for a match
-    bool operator==(const Record &rhs) const {return title == rhs.title || ID == rhs.ID; }
+    bool operator==(const Record &rhs) const
+        { return ID == rhs.ID || ((!title_block && !rhs.title_block) ? title == rhs.title : compare_stored_titles(rhs) == 0); }
     // Record inequality operator
-    bool operator!=(const Record &rhs) const {return title != rhs.title && ID != rhs.ID; }
+    bool operator!=(const Record &rhs) const { return !(*this == rhs); }
 
     friend std::ostream& operator<< (std::ostream& os, const Record& record);
 
 private:
-    static int ID_counter; // must be initialized to zero.
+    // titles are held in strings whose memory is counted as title storage
+    typedef std::basic_string<char, std::char_traits<char>, Counting_allocator<char, TITLE_MEMORY>> Title_string;
+
+public:
+    class Staged_title {
+        friend class Record;
+        Title_string title;
+        std::uint32_t title_block = 0;
+    };
+
+private:
+    static std::atomic<int> ID_counter; // must be initialized to zero.
     static int ID_backup;
-    std::string title;
+    static Title_store* title_store;
+    // the whole title, or its prefix if title_block is not 0
+    Title_string title;
     std::string medium;
     int ID;
     int rating;
+    int membership_count = 0;
+    // the block of the title in the title store, or 0 if the title is all here
+    std::uint32_t title_block = 0;
+
+    // The number of characters of a title of the given size that a Record holds itself
+    static std::size_t kept_title_size(std::size_t size)
+        { return title_store && size > TITLE_PREFIX_LENGTH ? TITLE_PREFIX_LENGTH : size; }
+    // Compare the titles of two Records, at least one of which has its title in the title store
+    int compare_stored_titles(const Record& rhs) const;
 };
 
 
+// Container used to hold the records in the library and its indexes
+typedef std::vector<Record*, Counting_allocator<Record*, INDEX_MEMORY>> Record_container;
+
 // Print a Record's data to the stream without a final endl. 
 // Output order is ID number followed by a ':' then medium, rating, title, separated by one space.
 // If the rating is zero, a 'u' is printed instead of the rating.
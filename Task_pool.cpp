@@ -0,0 +1,220 @@
+#include "Task_pool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <vector>
+
+using namespace std;
+
+// Start a pool that runs tasks on the given number of threads, including the one that asks for
+// each batch, so a pool of one thread runs every task on the asking thread
+Task_pool::Task_pool(unsigned num_threads)
+{
+    if (num_threads == 0)
+    {
+        num_threads = 1;
+    }
+    for (unsigned thread_index = 0; thread_index < num_threads; ++thread_index)
+    {
+        runs.emplace_back(new Run);
+    }
+    for (unsigned thread_index = 1; thread_index < num_threads; ++thread_index)
+    {
+        workers.emplace_back(&Task_pool::serve, this, thread_index);
+    }
+}
+
+// Stop the worker threads
+Task_pool::~Task_pool()
+{
+    {
+        lock_guard<mutex> batch_lock(batch_mutex);
+        stopping = true;
+    }
+    batch_started.notify_all();
+    for (thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Run task(i) for each i from 0 to num_tasks - 1 and return once all have finished.
+// The tasks may run in any order and at the same time as each other. If any task throws,
+// the rest still run, and then the first exception thrown is thrown again here.
+void Task_pool::run(size_t num_tasks, const function<void (size_t)>& task)
+{
+    if (workers.empty() || num_tasks <= 1)
+    {
+        exception_ptr exception;
+        for (size_t task_index = 0; task_index < num_tasks; ++task_index)
+        {
+            try
+            {
+                task(task_index);
+            } catch (...)
+            {
+                if (!exception)
+                {
+                    exception = current_exception();
+                }
+            }
+        }
+        if (exception)
+        {
+            rethrow_exception(exception);
+        }
+        return;
+    }
+
+    // deal the tasks out in runs as equal as can be, the first runs taking any left over
+    size_t run_begin = 0;
+    for (size_t thread_index = 0; thread_index < runs.size(); ++thread_index)
+    {
+        size_t run_size = num_tasks / runs.size() + (thread_index < num_tasks % runs.size() ? 1 : 0);
+        lock_guard<mutex> run_lock(runs[thread_index]->mutex);
+        runs[thread_index]->next = run_begin;
+        runs[thread_index]->end = run_begin + run_size;
+        run_begin += run_size;
+    }
+
+    {
+        lock_guard<mutex> batch_lock(batch_mutex);
+        batch_task = &task;
+        num_busy_workers = static_cast<unsigned>(workers.size());
+        first_exception = nullptr;
+        ++batch_number;
+    }
+    batch_started.notify_all();
+
+    work(0);
+
+    exception_ptr exception;
+    {
+        unique_lock<mutex> batch_lock(batch_mutex);
+        batch_finished.wait(batch_lock, [this] { return num_busy_workers == 0; });
+        batch_task = nullptr;
+        exception = first_exception;
+        first_exception = nullptr;
+    }
+    if (exception)
+    {
+        rethrow_exception(exception);
+    }
+}
+
+// Wait for batches and help run them until the pool stops
+void Task_pool::serve(unsigned thread_index)
+{
+    unsigned long long last_batch_number = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> batch_lock(batch_mutex);
+            batch_started.wait(batch_lock, [this, last_batch_number]
+                { return stopping || batch_number != last_batch_number; });
+            if (stopping)
+            {
+                return;
+            }
+            last_batch_number = batch_number;
+        }
+        work(thread_index);
+        bool last_done;
+        {
+            lock_guard<mutex> batch_lock(batch_mutex);
+            last_done = --num_busy_workers == 0;
+        }
+        if (last_done)
+        {
+            batch_finished.notify_one();
+        }
+    }
+}
+
+// Run tasks from this thread's run, and then stolen ones, until there are none left
+void Task_pool::work(unsigned thread_index)
+{
+    size_t task_index;
+    while (take_task(thread_index, task_index) || (steal_tasks(thread_index) && take_task(thread_index, task_index)))
+    {
+        try
+        {
+            (*batch_task)(task_index);
+        } catch (...)
+        {
+            lock_guard<mutex> batch_lock(batch_mutex);
+            if (!first_exception)
+            {
+                first_exception = current_exception();
+            }
+        }
+    }
+}
+
+// Take the next task of a thread's run; return false if it has none left
+bool Task_pool::take_task(unsigned thread_index, size_t& task_index)
+{
+    Run& run = *runs[thread_index];
+    lock_guard<mutex> run_lock(run.mutex);
+    if (run.next == run.end)
+    {
+        return false;
+    }
+    task_index = run.next++;
+    return true;
+}
+
+// Move the back half of the largest run left to this thread's run; return false if all are empty.
+// Only this thread adds to its own run, and only while the run is empty, so no two locks are ever held at once.
+bool Task_pool::steal_tasks(unsigned thread_index)
+{
+    while (true)
+    {
+        size_t victim_index = thread_index;
+        size_t victim_size = 0;
+        for (size_t other_index = 0; other_index < runs.size(); ++other_index)
+        {
+            if (other_index == thread_index)
+            {
+                continue;
+            }
+            lock_guard<mutex> run_lock(runs[other_index]->mutex);
+            size_t other_size = runs[other_index]->end - runs[other_index]->next;
+            if (other_size > victim_size)
+            {
+                victim_index = other_index;
+                victim_size = other_size;
+            }
+        }
+        if (victim_size == 0)
+        {
+            return false;
+        }
+
+        size_t stolen_begin, stolen_end;
+        {
+            Run& victim = *runs[victim_index];
+            lock_guard<mutex> run_lock(victim.mutex);
+            size_t remaining = victim.end - victim.next;
+            if (remaining == 0)
+            {
+                // emptied since it was looked at; look again
+                continue;
+            }
+            stolen_end = victim.end;
+            stolen_begin = victim.end - (remaining + 1) / 2;
+            victim.end = stolen_begin;
+        }
+        Run& run = *runs[thread_index];
+        lock_guard<mutex> run_lock(run.mutex);
+        run.next = stolen_begin;
+        run.end = stolen_end;
+        return true;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <vector>
+
+/*
+A Task_pool runs a batch of numbered tasks across several threads: the thread that asks for
+the batch and a set of worker threads kept waiting between batches. The tasks are first dealt
+out in equal runs, one run to each thread, and each thread takes tasks from the front of its
+own run; a thread that runs out steals the back half of the largest run left, so the threads
+stay busy when some tasks take longer than others. Each run has its own lock, which is held
+only while taking tasks from it.
+*/
+
+class Task_pool {
+public:
+    // Start a pool that runs tasks on the given number of threads, including the one that asks for
+    // each batch, so a pool of one thread runs every task on the asking thread
+    Task_pool(unsigned num_threads);
+    // Stop the worker threads
+    ~Task_pool();
+
+    Task_pool(const Task_pool&) = delete;
+    Task_pool& operator=(const Task_pool&) = delete;
+
+    // Run task(i) for each i from 0 to num_tasks - 1 and return once all have finished.
+    // The tasks may run in any order and at the same time as each other. If any task throws,
+    // the rest still run, and then the first exception thrown is thrown again here.
+    void run(std::size_t num_tasks, const std::function<void (std::size_t)>& task);
+
+    // The number of threads that run tasks
+    unsigned size() const
+        { return static_cast<unsigned>(runs.size()); }
+
+private:
+    // The tasks from next up to end that one thread has left to do
+    struct Run {
+        std::mutex mutex;
+        std::size_t next = 0;
+        std::size_t end = 0;
+    };
+
+    std::vector<std::unique_ptr<Run>> runs;
+    std::vector<std::thread> workers;
+
+    // the current batch, which a new batch number tells the workers to start on
+    std::mutex batch_mutex;
+    std::condition_variable batch_started;
+    std::condition_variable batch_finished;
+    unsigned long long batch_number = 0;
+    const std::function<void (std::size_t)>* batch_task = nullptr;
+    unsigned num_busy_workers = 0;
+    bool stopping = false;
+    std::exception_ptr first_exception;
+
+    // Wait for batches and help run them until the pool stops
+    void serve(unsigned thread_index);
+    // Run tasks from this thread's run, and then stolen ones, until there are none left
+    void work(unsigned thread_index);
+    // Take the next task of a thread's run; return false if it has none left
+    bool take_task(unsigned thread_index, std::size_t& task_index);
+    // Move the back half of the largest run left to this thread's run; return false if all are empty
+    bool steal_tasks(unsigned thread_index);
+};
+
+#endif
@@ -0,0 +1,352 @@
+#include "Title_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <unistd.h>
+
+#include "Utility.h"
+
+using namespace std;
+
+// the file starts with a header, so that no title is in block 0
+const char * const TITLE_STORE_HEADER = "P3TITLE\n";
+const size_t TITLE_STORE_HEADER_SIZE = 8;
+// each title is its size in 4 bytes, low byte first, then its characters, padded to a whole block
+const size_t TITLE_SIZE_BYTES = 4;
+// appended titles are written once this many bytes are pending
+const size_t TITLE_WRITE_BYTES = 1 << 16;
+// a title is read with one read of this many bytes, and a second read if it is longer
+const size_t TITLE_READ_BYTES = 128;
+// blocks fit in 32 bits
+const unsigned long long MAX_TITLE_STORE_BYTES = (1ULL << 32) * TITLE_BLOCK_SIZE;
+// the cache is split into up to this many shards, each with at least TITLE_CACHE_SHARD_MIN_BYTES of the budget,
+// so that a small budget is not divided into shares too small to hold a title
+const size_t TITLE_CACHE_SHARDS = 16;
+const size_t TITLE_CACHE_SHARD_MIN_BYTES = 1 << 16;
+
+const char * TITLE_STORE_WRITE_FAIL_MSG = "Could not write the title store!";
+const char * TITLE_STORE_READ_FAIL_MSG = "Could not read the title store!";
+
+// Create the store in a new temporary file, which is removed when the store is,
+// keeping up to budget_bytes of titles in memory. Throw Error exception if it cannot be created.
+Title_store::Title_store(size_t budget_bytes_) : budget_bytes{budget_bytes_},
+    num_shards{max<size_t>(1, min(TITLE_CACHE_SHARDS, budget_bytes_ / TITLE_CACHE_SHARD_MIN_BYTES))}
+{
+    shards.reset(new Cache_shard[num_shards]);
+    for (size_t i = 0; i < num_shards; ++i)
+    {
+        // the first shard takes what is left over from dividing the budget
+        shards[i].budget_bytes = budget_bytes / num_shards + (i == 0 ? budget_bytes % num_shards : 0);
+    }
+    const char* directory = getenv("TMPDIR");
+    string path = string(directory && *directory ? directory : "/tmp") + "/p3titles.XXXXXX";
+    fd = mkstemp(&path[0]);
+    if (fd < 0)
+    {
+        throw Error("Could not create the title store!");
+    }
+    // the file is only ever used through fd, so it can go from the directory at once
+    unlink(path.c_str());
+    pending.assign(TITLE_STORE_HEADER, TITLE_STORE_HEADER_SIZE);
+}
+
+Title_store::~Title_store()
+{
+    close(fd);
+}
+
+// Append a title to the store, keep it in memory as the most recently used, and return its block.
+// Throw Error exception if the file cannot be written.
+uint32_t Title_store::add(const char* title, size_t size)
+{
+    uint32_t block;
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        size_t entry_size = (TITLE_SIZE_BYTES + size + TITLE_BLOCK_SIZE - 1) / TITLE_BLOCK_SIZE * TITLE_BLOCK_SIZE;
+        unsigned long long offset = pending_offset + pending.size();
+        if (offset + entry_size > MAX_TITLE_STORE_BYTES)
+        {
+            throw Error("Title store is full!");
+        }
+        block = static_cast<uint32_t>(offset / TITLE_BLOCK_SIZE);
+        size_t start = pending.size();
+        for (size_t i = 0; i < TITLE_SIZE_BYTES; ++i)
+        {
+            pending += static_cast<char>((size >> (8 * i)) & 0xff);
+        }
+        pending.append(title, size);
+        pending.resize(start + entry_size, '\0');
+        ++num_titles;
+        if (pending.size() >= TITLE_WRITE_BYTES)
+        {
+            flush();
+        }
+    }
+    Cache_shard& shard = shard_for(block);
+    lock_guard<mutex> lock(shard.shard_mutex);
+    remember(shard, block, title, size);
+    return block;
+}
+
+// Copy the title in a block into dest, reading it from the file if it is not in memory.
+// Throw Error exception if the file cannot be read.
+void Title_store::get(uint32_t block, string& dest)
+{
+    Cache_shard& shard = shard_for(block);
+    {
+        lock_guard<mutex> lock(shard.shard_mutex);
+        if (const Entry* entry = find(shard, block))
+        {
+            ++hits;
+            dest.assign(entry->title);
+            return;
+        }
+    }
+    ++misses;
+    // the file is read without the shard locked, so another thread may read the same title meanwhile
+    read_title(block, dest);
+    lock_guard<mutex> lock(shard.shard_mutex);
+    if (!shard.index.count(block))
+    {
+        remember(shard, block, dest.data(), dest.size());
+    }
+}
+
+// Compare the title in a block with another title, in a block or given by its characters, as
+// std::string::compare does, starting at pos, before which the caller knows they are the same.
+// A title in memory is compared where it is, without being copied.
+// Throw Error exception if the file cannot be read.
+int Title_store::compare(uint32_t block, uint32_t other_block, size_t pos)
+{
+    if (block == other_block)
+    {
+        return 0;
+    }
+    Cache_shard& shard = shard_for(block);
+    Cache_shard& other_shard = shard_for(other_block);
+    {
+        unique_lock<mutex> lock(shard.shard_mutex, defer_lock), other_lock(other_shard.shard_mutex, defer_lock);
+        if (&shard == &other_shard)
+        {
+            lock.lock();
+        } else
+        {
+            std::lock(lock, other_lock);
+        }
+        const Entry* entry = find(shard, block);
+        const Entry* other_entry = find(other_shard, other_block);
+        if (entry && other_entry)
+        {
+            hits += 2;
+            return entry->title.compare(pos, string::npos, other_entry->title, pos, string::npos);
+        }
+    }
+    // comparisons are frequent, so each thread fetches titles into strings it keeps for the purpose;
+    // the lookups in memory above are counted by the calls below
+    static thread_local string other_title;
+    get(other_block, other_title);
+    return compare(block, other_title.data(), other_title.size(), pos);
+}
+
+int Title_store::compare(uint32_t block, const char* other, size_t size, size_t pos)
+{
+    Cache_shard& shard = shard_for(block);
+    {
+        lock_guard<mutex> lock(shard.shard_mutex);
+        if (const Entry* entry = find(shard, block))
+        {
+            ++hits;
+            return entry->title.compare(pos, string::npos, other + pos, size - pos);
+        }
+    }
+    static thread_local string title;
+    get(block, title);
+    return title.compare(pos, string::npos, other + pos, size - pos);
+}
+
+size_t Title_store::get_resident_bytes() const
+{
+    size_t resident_bytes = 0;
+    for (size_t i = 0; i < num_shards; ++i)
+    {
+        lock_guard<mutex> lock(shards[i].shard_mutex);
+        resident_bytes += shards[i].resident_bytes;
+    }
+    return resident_bytes;
+}
+
+unsigned long long Title_store::get_num_titles() const
+{
+    lock_guard<mutex> lock(pending_mutex);
+    return num_titles;
+}
+
+unsigned long long Title_store::get_file_bytes() const
+{
+    lock_guard<mutex> lock(pending_mutex);
+    return pending_offset + pending.size();
+}
+
+unsigned long long Title_store::get_hits() const
+{
+    return hits;
+}
+
+unsigned long long Title_store::get_misses() const
+{
+    return misses;
+}
+
+// What keeping a title of size characters in memory takes: the list node with its entry and two links,
+// the index node with its block, iterator, link and hash, a bucket, and the string's own allocation
+// if the title is too long to be kept inside the string
+size_t Title_store::entry_bytes(size_t size)
+{
+    static const size_t inline_capacity = string().capacity();
+    size_t list_node = sizeof(Entry) + 2 * sizeof(void*);
+    size_t index_node = sizeof(Entry_index::value_type) + sizeof(void*) + sizeof(size_t);
+    size_t bucket = sizeof(void*);
+    return list_node + index_node + bucket + (size > inline_capacity ? size + 1 : 0);
+}
+
+// Return the entry for a block in a locked shard, made the most recently used, or nullptr if it is not in memory
+const Title_store::Entry* Title_store::find(Cache_shard& shard, uint32_t block)
+{
+    auto index_it = shard.index.find(block);
+    if (index_it == shard.index.end())
+    {
+        return nullptr;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, index_it->second);
+    return &*index_it->second;
+}
+
+// Keep a title in a locked shard as the most recently used, dropping others to stay within its budget
+void Title_store::remember(Cache_shard& shard, uint32_t block, const char* title, size_t size)
+{
+    size_t bytes = entry_bytes(size);
+    // a title that takes more than the shard's whole budget is only kept in the file
+    if (bytes > shard.budget_bytes)
+    {
+        return;
+    }
+    while (shard.resident_bytes + bytes > shard.budget_bytes)
+    {
+        shard.resident_bytes -= shard.entries.back().bytes;
+        shard.index.erase(shard.entries.back().block);
+        shard.entries.pop_back();
+    }
+    shard.entries.push_front(Entry{block, string(title, size), bytes});
+    try
+    {
+        shard.index[block] = shard.entries.begin();
+    } catch (...)
+    {
+        shard.entries.pop_front();
+        throw;
+    }
+    shard.resident_bytes += bytes;
+}
+
+// Write the pending titles to the file; pending_mutex must be held
+void Title_store::flush()
+{
+    size_t written = 0;
+    while (written < pending.size())
+    {
+        ssize_t result = pwrite(fd, pending.data() + written, pending.size() - written, pending_offset + written);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            throw Error(TITLE_STORE_WRITE_FAIL_MSG);
+        }
+        written += result;
+    }
+    pending_offset += pending.size();
+    pending.clear();
+}
+
+// Read all of size bytes at offset in a file into buffer; return the number read, less only at the end of the file
+size_t read_at(int fd, char* buffer, size_t size, unsigned long long offset)
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        ssize_t result = pread(fd, buffer + total, size - total, offset + total);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result < 0)
+        {
+            throw Error(TITLE_STORE_READ_FAIL_MSG);
+        }
+        if (result == 0)
+        {
+            break;
+        }
+        total += result;
+    }
+    return total;
+}
+
+// Read the title in a block into dest
+void Title_store::read_title(uint32_t block, string& dest)
+{
+    unsigned long long offset = static_cast<unsigned long long>(block) * TITLE_BLOCK_SIZE;
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        if (offset < TITLE_STORE_HEADER_SIZE || offset + TITLE_SIZE_BYTES > pending_offset + pending.size())
+        {
+            throw Error(TITLE_STORE_READ_FAIL_MSG);
+        }
+        // a title appended since the last write is still in the pending bytes
+        if (offset >= pending_offset)
+        {
+            size_t start = offset - pending_offset;
+            size_t size = 0;
+            for (size_t i = 0; i < TITLE_SIZE_BYTES; ++i)
+            {
+                size |= static_cast<size_t>(static_cast<unsigned char>(pending[start + i])) << (8 * i);
+            }
+            dest.assign(pending, start + TITLE_SIZE_BYTES, size);
+            return;
+        }
+    }
+    // a title before pending_offset is written whole and never changes, so the file is read unlocked
+    char buffer[TITLE_READ_BYTES];
+    size_t num_read = read_at(fd, buffer, TITLE_READ_BYTES, offset);
+    if (num_read < TITLE_SIZE_BYTES)
+    {
+        throw Error(TITLE_STORE_READ_FAIL_MSG);
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < TITLE_SIZE_BYTES; ++i)
+    {
+        size |= static_cast<size_t>(static_cast<unsigned char>(buffer[i])) << (8 * i);
+    }
+    size_t in_buffer = min(size, num_read - TITLE_SIZE_BYTES);
+    dest.assign(buffer + TITLE_SIZE_BYTES, in_buffer);
+    if (in_buffer < size)
+    {
+        dest.resize(size);
+        if (read_at(fd, &dest[in_buffer], size - in_buffer, offset + TITLE_SIZE_BYTES + in_buffer) < size - in_buffer)
+        {
+            throw Error(TITLE_STORE_READ_FAIL_MSG);
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef TITLE_STORE_H
+#define TITLE_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/*
+A Title_store keeps the full titles of records on disk, so that a library can be bigger than
+the memory it is allowed for titles. Titles are appended to a temporary file and never changed
+or removed there; a title that changes is appended again. Each title is found by its block,
+its position in the file in units of TITLE_BLOCK_SIZE bytes, which fits in 32 bits for files
+of up to 32 GiB. In front of the file is a cache of the titles used most recently, which holds
+at most the budget's worth of memory, counting each title's characters and the list and index
+nodes that hold it, and drops the least recently used titles to stay within it.
+The store may be used from any thread. A big cache is split into shards by block, each with its
+own share of the budget and its own lock, and the titles not yet written have a lock of their
+own, so threads looking up different titles seldom wait for each other; reading the file
+takes no lock.
+*/
+
+const std::size_t TITLE_BLOCK_SIZE = 8;
+
+class Title_store {
+public:
+    // Create the store in a new temporary file, which is removed when the store is,
+    // keeping up to budget_bytes of titles in memory. Throw Error exception if it cannot be created.
+    Title_store(std::size_t budget_bytes_);
+    ~Title_store();
+
+    Title_store(const Title_store&) = delete;
+    Title_store& operator=(const Title_store&) = delete;
+
+    // Append a title to the store, keep it in memory as the most recently used, and return its block.
+    // Throw Error exception if the file cannot be written.
+    std::uint32_t add(const char* title, std::size_t size);
+
+    // Copy the title in a block into dest, reading it from the file if it is not in memory.
+    // Throw Error exception if the file cannot be read.
+    void get(std::uint32_t block, std::string& dest);
+
+    // Compare the title in a block with another title, in a block or given by its characters, as
+    // std::string::compare does, starting at pos, before which the caller knows they are the same.
+    // A title in memory is compared where it is, without being copied.
+    // Throw Error exception if the file cannot be read.
+    int compare(std::uint32_t block, std::uint32_t other_block, std::size_t pos);
+    int compare(std::uint32_t block, const char* other, std::size_t size, std::size_t pos);
+
+    // The budget, the number of bytes the titles in memory take, the numbers of titles and bytes appended,
+    // and counts of lookups found in memory or read from the file
+    std::size_t get_budget() const
+        { return budget_bytes; }
+    std::size_t get_resident_bytes() const;
+    unsigned long long get_num_titles() const;
+    unsigned long long get_file_bytes() const;
+    unsigned long long get_hits() const;
+    unsigned long long get_misses() const;
+
+private:
+    struct Entry {
+        std::uint32_t block;
+        std::string title;
+        // what the entry takes in memory, charged against the budget
+        std::size_t bytes;
+    };
+    typedef std::list<Entry> Entry_list;
+    typedef std::unordered_map<std::uint32_t, Entry_list::iterator> Entry_index;
+
+    // a part of the cache, holding the titles of the blocks that map to it within its share of the budget
+    struct Cache_shard {
+        std::mutex shard_mutex;
+        // the titles in memory, most recently used first, and where to find each block in the list
+        Entry_list entries;
+        Entry_index index;
+        std::size_t budget_bytes = 0;
+        std::size_t resident_bytes = 0;
+    };
+
+    int fd;
+    std::size_t budget_bytes;
+    std::unique_ptr<Cache_shard[]> shards;
+    std::size_t num_shards;
+    // guards the appended titles not yet written, which start at pending_offset in the file
+    mutable std::mutex pending_mutex;
+    std::string pending;
+    unsigned long long pending_offset = 0;
+    unsigned long long num_titles = 0;
+    std::atomic<unsigned long long> hits{0}, misses{0};
+
+    // What keeping a title of size characters in memory takes
+    static std::size_t entry_bytes(std::size_t size);
+    // titles are usually a similar number of blocks apart, so blocks are scattered before choosing a shard
+    Cache_shard& shard_for(std::uint32_t block)
+        { return shards[(static_cast<std::uint32_t>(block * 2654435761u) >> 16) % num_shards]; }
+    // Return the entry for a block in a locked shard, made the most recently used, or nullptr if it is not in memory
+    const Entry* find(Cache_shard& shard, std::uint32_t block);
+    // Keep a title in a locked shard as the most recently used, dropping others to stay within its budget
+    void remember(Cache_shard& shard, std::uint32_t block, const char* title, std::size_t size);
+    // Write the pending titles to the file; pending_mutex must be held
+    void flush();
+    // Read the title in a block into dest
+    void read_title(std::uint32_t block, std::string& dest);
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "Trace.h"
+
+#include <cstddef>
+#include <ostream>
+
+#ifdef P3_TRACE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+// the number of spans each thread keeps
+const size_t TRACE_RING_SPANS = 1 << 16;
+
+struct Trace_event {
+    const char* name;
+    char detail[Trace_span::DETAIL_SIZE + 1];
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+// The spans recorded by one thread, the oldest overwritten once it is full.
+// Only its own thread adds to it, but any thread may write it out, so it has a lock.
+struct Trace_ring {
+    mutex ring_mutex;
+    vector<Trace_event> events;
+    size_t next = 0;
+    unsigned long long num_recorded = 0;
+    int thread_number;
+
+    Trace_ring(int thread_number_) : events(TRACE_RING_SPANS), thread_number{thread_number_} {}
+};
+
+// The rings of all threads that have recorded a span, which outlive their threads so that
+// their spans can still be written out
+mutex rings_mutex;
+vector<shared_ptr<Trace_ring>> rings;
+
+// Return the ring of the current thread, making it the first time
+Trace_ring& thread_ring()
+{
+    thread_local Trace_ring* ring = nullptr;
+    if (!ring)
+    {
+        lock_guard<mutex> rings_lock(rings_mutex);
+        rings.push_back(make_shared<Trace_ring>(static_cast<int>(rings.size()) + 1));
+        ring = rings.back().get();
+    }
+    return *ring;
+}
+
+uint64_t nanoseconds(chrono::steady_clock::time_point time)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+Trace_span::Trace_span(const char* name_, const string& detail_) :
+    name{name_}, start{chrono::steady_clock::now()}
+{
+    detail_.copy(detail, DETAIL_SIZE);
+}
+
+Trace_span::~Trace_span()
+{
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    Trace_ring& ring = thread_ring();
+    lock_guard<mutex> ring_lock(ring.ring_mutex);
+    Trace_event& event = ring.events[ring.next];
+    event.name = name;
+    copy(detail, detail + DETAIL_SIZE + 1, event.detail);
+    event.start_ns = nanoseconds(start);
+    event.duration_ns = nanoseconds(end) - event.start_ns;
+    ring.next = (ring.next + 1) % TRACE_RING_SPANS;
+    ++ring.num_recorded;
+}
+
+// Write a string as a JSON string
+void write_json_string(ostream& os, const char* text)
+{
+    os << '"';
+    for (; *text; ++text)
+    {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\')
+        {
+            os << '\\' << c;
+        } else if (c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof escaped, "\\u%04x", c);
+            os << escaped;
+        } else
+        {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+// Write a time in nanoseconds as microseconds, the unit of trace events
+void write_microseconds(ostream& os, uint64_t ns)
+{
+    char formatted[32];
+    snprintf(formatted, sizeof formatted, "%llu.%03u", static_cast<unsigned long long>(ns / 1000), static_cast<unsigned>(ns % 1000));
+    os << formatted;
+}
+
+// Write the spans recorded by all threads to the stream as Chrome trace-event JSON and return how many there were.
+// Without P3_TRACE, this writes a trace with no spans.
+size_t write_trace(ostream& os)
+{
+    size_t num_spans = 0;
+    int pid = getpid();
+    os << "{\"traceEvents\":[";
+    lock_guard<mutex> rings_lock(rings_mutex);
+    for (const shared_ptr<Trace_ring>& ring : rings)
+    {
+        lock_guard<mutex> ring_lock(ring->ring_mutex);
+        // the oldest span kept is at next once the ring has filled
+        size_t num_kept = ring->num_recorded < TRACE_RING_SPANS ? ring->num_recorded : TRACE_RING_SPANS;
+        size_t first = ring->num_recorded < TRACE_RING_SPANS ? 0 : ring->next;
+        for (size_t i = 0; i < num_kept; ++i)
+        {
+            const Trace_event& event = ring->events[(first + i) % TRACE_RING_SPANS];
+            os << (num_spans++ ? ",\n" : "\n") << "{\"name\":";
+            write_json_string(os, event.name);
+            os << ",\"ph\":\"X\",\"ts\":";
+            write_microseconds(os, event.start_ns);
+            os << ",\"dur\":";
+            write_microseconds(os, event.duration_ns);
+            os << ",\"pid\":" << pid << ",\"tid\":" << ring->thread_number;
+            if (event.detail[0])
+            {
+                os << ",\"args\":{\"detail\":";
+                write_json_string(os, event.detail);
+                os << "}";
+            }
+            os << "}";
+        }
+    }
+    os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    return num_spans;
+}
+
+#else
+
+using namespace std;
+
+// Write the spans recorded by all threads to the stream as Chrome trace-event JSON and return how many there were.
+// Without P3_TRACE, this writes a trace with no spans.
+size_t write_trace(ostream& os)
+{
+    os << "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}\n";
+    return 0;
+}
+
+#endif
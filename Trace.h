@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <ostream>
+
+/*
+Trace spans time the stages of a command, such as looking up a title or saving each collection,
+for a detailed view of where its time goes. They are compiled in only when P3_TRACE is defined
+(make TRACE=1); otherwise TRACE_SPAN expands to nothing and costs nothing.
+
+TRACE_SPAN(name) or TRACE_SPAN(name, detail) times the rest of the enclosing block. The name must be
+a string literal; the detail is a std::string, of which the first few characters are kept. Each thread
+records its spans in its own ring buffer, which keeps the most recent spans once it is full.
+The spans of all threads can be written as Chrome trace-event JSON, which chrome://tracing and
+Perfetto display as a timeline.
+*/
+
+#ifdef P3_TRACE
+
+#include <chrono>
+#include <string>
+
+const bool TRACE_COMPILED_IN = true;
+
+// Times its own lifetime and records it as a span of the current thread when it is destroyed
+class Trace_span {
+public:
+    Trace_span(const char* name_) :
+        name{name_}, start{std::chrono::steady_clock::now()} {}
+    Trace_span(const char* name_, const std::string& detail_);
+    ~Trace_span();
+
+    Trace_span(const Trace_span&) = delete;
+    Trace_span& operator=(const Trace_span&) = delete;
+
+    // the number of characters of the detail that are kept
+    static const std::size_t DETAIL_SIZE = 15;
+
+private:
+    const char* name;
+    char detail[DETAIL_SIZE + 1] = {};
+    std::chrono::steady_clock::time_point start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) Trace_span TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+
+#else
+
+const bool TRACE_COMPILED_IN = false;
+
+#define TRACE_SPAN(...)
+
+#endif
+
+// Write the spans recorded by all threads to the stream as Chrome trace-event JSON and return how many there were.
+// Without P3_TRACE, this writes a trace with no spans.
+std::size_t write_trace(std::ostream& os);
+
+#endif
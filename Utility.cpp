@@ -1,5 +1,36 @@
 #include "Utility.h"
 
+#include <string>
+
+#include "Normalize.h"
+#include "Trace.h"
+
 using namespace std;
 
-const char * FILE_ERROR_MSG = "Invalid data found in file!";
\ No newline at end of file
+const char * FILE_ERROR_MSG = "Invalid data found in file!";
+
+// Processes a string and removes excess whitespace
+string parse_title(const string& original)
+{
+    TRACE_SPAN("parse_title");
+    string title(original.size(), '\0');
+    title.resize(normalize_title(original.data(), original.size(), &title[0]));
+    // a title read from a heavily padded line would otherwise keep the capacity of the whole line,
+    // which matters where parsed titles are held in bulk, as in ir's batches
+    if (title.size() < title.capacity() / 2)
+    {
+        title.shrink_to_fit();
+    }
+    return title;
+}
+
+// Add a number to some bytes as a varint: 7 bits per byte, low bits first, with the high bit set on every byte but the last
+void append_varint(string& bytes, unsigned long long number)
+{
+    while (number >= 0x80)
+    {
+        bytes += static_cast<char>((number & 0x7f) | 0x80);
+        number >>= 7;
+    }
+    bytes += static_cast<char>(number);
+}
@@ -1,6 +1,8 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <string>
+
 /* Utility functions, constants, and classes used by more than one other modules */
 
 extern const char * FILE_ERROR_MSG;
@@ -27,4 +29,10 @@ struct Less_than_ptr {
     bool operator()(const T p1, const T p2) const {return *p1 < *p2;}
 };
 
+// Processes a string and removes excess whitespace
+std::string parse_title(const std::string& original);
+
+// Add a number to some bytes as a varint: 7 bits per byte, low bits first, with the high bit set on every byte but the last
+void append_varint(std::string& bytes, unsigned long long number);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,286 @@
+/* Decodes a columnar export written by p3exe's eA command and prints the library and catalog
+ * in the save file format that sA writes, so that an export can be checked against a save of the
+ * same data. The format is read from its description in Export.h without using the writer's code.
+ *
+ * Usage: p3cols export_file
+ * The exit status is 0 if the export was decoded, and 2 if it could not be read or is not valid.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+using namespace std;
+
+const string EXPORT_HEADER = "P3COLS1\n";
+
+// a part of the export that is not in the format, to report with where it was found
+struct Invalid_export {
+    string what;
+};
+
+// a record as the library table holds it
+struct Record_row {
+    int ID;
+    string medium;
+    unsigned long long rating;
+    string title;
+};
+
+// Reads the parts of the export from a string of bytes, in order
+class Export_cursor {
+public:
+    Export_cursor(const string& bytes_, size_t pos_, size_t end_) : bytes(bytes_), pos(pos_), end(end_) {}
+
+    bool at_end() const
+        { return pos == end; }
+
+    unsigned long long read_varint()
+    {
+        unsigned long long number = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            if (pos == end || shift > 63)
+            {
+                throw Invalid_export{"varint"};
+            }
+            unsigned char byte = bytes[pos++];
+            number |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                return number;
+            }
+        }
+    }
+    long long read_signed_varint()
+    {
+        unsigned long long number = read_varint();
+        return number & 1 ? ~static_cast<long long>(number >> 1) : static_cast<long long>(number >> 1);
+    }
+    char read_char()
+    {
+        if (pos == end)
+        {
+            throw Invalid_export{"table tag"};
+        }
+        return bytes[pos++];
+    }
+    string read_bytes(unsigned long long size)
+    {
+        if (size > end - pos)
+        {
+            throw Invalid_export{"string"};
+        }
+        pos += size;
+        return bytes.substr(pos - size, size);
+    }
+    // Return a cursor over the next column, and move past it
+    Export_cursor read_column()
+    {
+        unsigned long long size = read_varint();
+        if (size > end - pos)
+        {
+            throw Invalid_export{"column size"};
+        }
+        pos += size;
+        return Export_cursor(bytes, pos - size, pos);
+    }
+
+private:
+    const string& bytes;
+    size_t pos;
+    size_t end;
+};
+
+// Read a column of numbers kept as runs, each its length and number, expanding them to the given number of rows
+vector<unsigned long long> read_runs(Export_cursor& column, unsigned long long num_rows)
+{
+    vector<unsigned long long> numbers;
+    while (numbers.size() < num_rows)
+    {
+        unsigned long long run_length = column.read_varint(), number = column.read_varint();
+        if (run_length == 0 || run_length > num_rows - numbers.size())
+        {
+            throw Invalid_export{"run length"};
+        }
+        numbers.insert(numbers.end(), run_length, number);
+    }
+    return numbers;
+}
+
+// Read a column of strings kept as their lengths followed by the size and bytes of the blob of all of them
+vector<string> read_lengths_and_blob(Export_cursor& column, unsigned long long num_rows)
+{
+    vector<unsigned long long> lengths;
+    for (unsigned long long row = 0; row < num_rows; ++row)
+    {
+        lengths.push_back(column.read_varint());
+    }
+    Export_cursor blob(column.read_column());
+    vector<string> strings;
+    transform(lengths.begin(), lengths.end(), back_inserter(strings), [&blob](unsigned long long length) { return blob.read_bytes(length); });
+    if (!blob.at_end())
+    {
+        throw Invalid_export{"blob size"};
+    }
+    return strings;
+}
+
+// Read a column of IDs, each the signed difference from the one before
+vector<int> read_ID_differences(Export_cursor& column, unsigned long long num_rows)
+{
+    vector<int> IDs;
+    long long ID = 0;
+    for (unsigned long long row = 0; row < num_rows; ++row)
+    {
+        ID += column.read_signed_varint();
+        IDs.push_back(static_cast<int>(ID));
+    }
+    return IDs;
+}
+
+// Throw unless every byte of a column has been read
+void check_column_end(const Export_cursor& column, const string& what)
+{
+    if (!column.at_end())
+    {
+        throw Invalid_export{what + " column size"};
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        cerr << "Usage: " << argv[0] << " export_file\n";
+        return 2;
+    }
+    ifstream file(argv[1], ios::binary);
+    string bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (!file)
+    {
+        cerr << "Could not read " << argv[1] << "\n";
+        return 2;
+    }
+    vector<Record_row> records;
+    vector<pair<string, unsigned long long>> collections;
+    // the member IDs of each collection, by its number
+    map<unsigned long long, vector<int>> members;
+    try
+    {
+        if (bytes.compare(0, EXPORT_HEADER.size(), EXPORT_HEADER) != 0)
+        {
+            throw Invalid_export{"header"};
+        }
+        Export_cursor cursor(bytes, EXPORT_HEADER.size(), bytes.size());
+        for (char tag = cursor.read_char(); tag != 'E'; tag = cursor.read_char())
+        {
+            unsigned long long num_rows = cursor.read_varint();
+            if (tag == 'L')
+            {
+                Export_cursor ID_column(cursor.read_column()), medium_column(cursor.read_column()),
+                    rating_column(cursor.read_column()), title_column(cursor.read_column());
+                vector<int> IDs = read_ID_differences(ID_column, num_rows);
+                vector<string> dictionary;
+                for (unsigned long long size = medium_column.read_varint(); dictionary.size() < size; )
+                {
+                    dictionary.push_back(medium_column.read_bytes(medium_column.read_varint()));
+                }
+                vector<unsigned long long> medium_indexes = read_runs(medium_column, num_rows);
+                vector<unsigned long long> ratings = read_runs(rating_column, num_rows);
+                vector<string> titles = read_lengths_and_blob(title_column, num_rows);
+                check_column_end(ID_column, "ID");
+                check_column_end(medium_column, "medium");
+                check_column_end(rating_column, "rating");
+                check_column_end(title_column, "title");
+                for (unsigned long long row = 0; row < num_rows; ++row)
+                {
+                    if (medium_indexes[row] >= dictionary.size())
+                    {
+                        throw Invalid_export{"medium index"};
+                    }
+                    records.push_back(Record_row{IDs[row], dictionary[medium_indexes[row]], ratings[row], titles[row]});
+                }
+            } else if (tag == 'C')
+            {
+                Export_cursor name_column(cursor.read_column()), size_column(cursor.read_column());
+                vector<string> names = read_lengths_and_blob(name_column, num_rows);
+                for (unsigned long long row = 0; row < num_rows; ++row)
+                {
+                    collections.push_back(make_pair(names[row], size_column.read_varint()));
+                }
+                check_column_end(name_column, "name");
+                check_column_end(size_column, "size");
+            } else if (tag == 'M')
+            {
+                Export_cursor collection_column(cursor.read_column()), record_column(cursor.read_column());
+                vector<unsigned long long> collection_numbers = read_runs(collection_column, num_rows);
+                vector<int> IDs = read_ID_differences(record_column, num_rows);
+                check_column_end(collection_column, "collection");
+                check_column_end(record_column, "record");
+                for (unsigned long long row = 0; row < num_rows; ++row)
+                {
+                    // the collections of a membership group come before it
+                    if (collection_numbers[row] >= collections.size())
+                    {
+                        throw Invalid_export{"collection number"};
+                    }
+                    members[collection_numbers[row]].push_back(IDs[row]);
+                }
+            } else
+            {
+                throw Invalid_export{"table tag"};
+            }
+        }
+        unsigned long long num_memberships = 0;
+        for_each(members.begin(), members.end(), [&num_memberships](const pair<const unsigned long long, vector<int>>& collection)
+            { num_memberships += collection.second.size(); });
+        if (cursor.read_varint() != records.size() || cursor.read_varint() != collections.size()
+            || cursor.read_varint() != num_memberships || !cursor.at_end())
+        {
+            throw Invalid_export{"footer"};
+        }
+    } catch (Invalid_export& invalid)
+    {
+        cerr << "Invalid export: bad " << invalid.what << "\n";
+        return 2;
+    }
+
+    map<int, const string*> titles_by_ID;
+    for_each(records.begin(), records.end(), [&titles_by_ID](const Record_row& record) { titles_by_ID[record.ID] = &record.title; });
+    cout << records.size() << "\n";
+    for_each(records.begin(), records.end(), [](const Record_row& record)
+        { cout << record.ID << " " << record.medium << " " << record.rating << " " << record.title << "\n"; });
+    cout << collections.size() << "\n";
+    for (size_t number = 0; number < collections.size(); ++number)
+    {
+        const vector<int>& IDs = members[number];
+        if (IDs.size() != collections[number].second)
+        {
+            cerr << "Invalid export: collection " << collections[number].first << " has the wrong number of members\n";
+            return 2;
+        }
+        // a save lists the members in title order
+        vector<string> titles;
+        for (int ID : IDs)
+        {
+            auto title_it = titles_by_ID.find(ID);
+            if (title_it == titles_by_ID.end())
+            {
+                cerr << "Invalid export: collection " << collections[number].first << " has a member not in the library\n";
+                return 2;
+            }
+            titles.push_back(*title_it->second);
+        }
+        sort(titles.begin(), titles.end());
+        cout << collections[number].first << " " << titles.size() << "\n";
+        for_each(titles.begin(), titles.end(), [](const string& title) { cout << title << "\n"; });
+    }
+    return 0;
+}
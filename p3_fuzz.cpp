@@ -0,0 +1,126 @@
+/* Differential fuzz test for title normalization: checks that every normalization kernel
+ * the processor supports produces exactly the same titles as the original
+ * character-at-a-time parser, on random inputs rich in whitespace.
+ *
+ * Usage: p3fuzz [iterations [seed]]
+ * The exit status is 0 if every kernel agreed on every input, and 1 otherwise.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <cctype>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include "Normalize.h"
+
+using namespace std;
+
+// the original functor used to parse a string and remove excess whitespace, kept as the reference
+struct title_parser
+{
+    void operator()(char c)
+    {
+        if (!isspace(c))
+        {
+            title.push_back(c);
+            remove_whitespace = false;
+        } else
+        {
+            /* if remove_whitespace is false, the last character read must not have been whitespace and we need
+             * a space, otherwise do not add this character to the string
+             */
+            if (!remove_whitespace)
+            {
+                title.push_back(' ');
+            }
+            remove_whitespace = true;
+        }
+    }
+    // removes terminating whitespace from processed string
+    void finalize()
+    {
+        if (!title.empty() && isspace(title.back()))
+        {
+            title.pop_back();
+        }
+    }
+    string get_title() { return title; }
+private:
+    string title;
+    bool remove_whitespace = true;
+};
+
+// Processes a string and removes excess whitespace the original way
+string reference_parse_title(const string& original)
+{
+    title_parser title_helper;
+    for_each(original.begin(), original.end(), ref(title_helper));
+    title_helper.finalize();
+    return title_helper.get_title();
+}
+
+// Returns a random input of up to max_length characters; some inputs are mostly single spaces
+// between words, as titles usually are, and others have whitespace of every kind in any arrangement
+string random_input(mt19937& generator, size_t max_length)
+{
+    const string whitespace = " \t\n\v\f\r";
+    size_t length = uniform_int_distribution<size_t>(0, max_length)(generator);
+    int whitespace_percent = uniform_int_distribution<int>(0, 3)(generator) == 0 ? 60 : 15;
+    bool title_like = uniform_int_distribution<int>(0, 1)(generator) == 0;
+    uniform_int_distribution<int> percent(0, 99);
+    string input;
+    while (input.size() < length)
+    {
+        if (percent(generator) >= whitespace_percent)
+        {
+            // mostly letters, and sometimes any byte at all
+            input += percent(generator) < 95 ? static_cast<char>(uniform_int_distribution<int>('a', 'z')(generator))
+                : static_cast<char>(uniform_int_distribution<int>(0, 255)(generator));
+        } else if (title_like && (input.empty() || input.back() != ' ') && percent(generator) < 90)
+        {
+            input += ' ';
+        } else
+        {
+            input += whitespace[uniform_int_distribution<size_t>(0, whitespace.size() - 1)(generator)];
+        }
+    }
+    return input;
+}
+
+int main(int argc, char* argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    unsigned long seed = argc > 2 ? strtoul(argv[2], nullptr, 10) : 381;
+    mt19937 generator(seed);
+    vector<Normalize_kernel> kernels = supported_normalize_kernels();
+    // the output goes at an odd offset so that unaligned stores are exercised
+    vector<char> buffer;
+    long failures = 0;
+    for (long i = 0; i < iterations; ++i)
+    {
+        string input = random_input(generator, i % 10 == 0 ? 300 : 80);
+        string expected = reference_parse_title(input);
+        buffer.assign(input.size() + 1, '\0');
+        for (auto& kernel : kernels)
+        {
+            string actual(buffer.data() + 1, kernel.normalize(input.data(), input.size(), buffer.data() + 1));
+            if (actual != expected && ++failures <= 5)
+            {
+                cout << kernel.name << " kernel differs on input of length " << input.size()
+                    << " (iteration " << i << ", seed " << seed << ")\n";
+            }
+        }
+    }
+    cout << "Checked " << iterations << " inputs against kernels:";
+    for (auto& kernel : kernels)
+    {
+        cout << " " << kernel.name;
+    }
+    cout << "\n" << failures << " differences found\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -7,14 +7,35 @@
 #include <functional>
 #include <iterator>
 #include <cassert>
+#include <climits>
+#include <sstream>
+#include <cstdlib>
+#include <thread>
 
 #include <string>
 #include <vector>
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
 
 #include "Record.h"
+#include "Cache.h"
+#include "Capture.h"
+#include "Catalog.h"
 #include "Collection.h"
+#include "Export.h"
+#include "Feed.h"
+#include "ID_table.h"
+#include "Ingest.h"
+#include "Memory.h"
+#include "Multi_index.h"
+#include "Output.h"
+#include "Partition.h"
+#include "Task_pool.h"
+#include "Title_store.h"
+#include "Trace.h"
 #include "Utility.h"
 
 using namespace std;
@@ -22,74 +43,194 @@ using namespace std;
 const char * UNRECOGNIZED_MSG = "Unrecognized command!";
 const char * FILE_OPEN_FAIL_MSG = "Could not open file!";
 const char * LIBRARY_EMPTY_MSG = "Library is empty\n";
+const char * INVALID_QUERY_MSG = "Invalid query!";
+const char * NO_TITLE_MSG = "No record with that title!";
+const char * NO_ID_MSG = "No record with that ID!";
+const char * NO_NAME_MSG = "No collection with that name!";
+const char * DUPLICATE_TITLE_MSG = "Library already has a record with this title!";
+const char * INVALID_FILTER_MSG = "Invalid member filter!";
+const char * REPLICA_STOPPED_MSG = "The replica has stopped following the change feed: ";
 
 /* data types */
 
-// Records in the library are held in the following container
-typedef std::vector<Record*> Record_container;
-// Collections in the catalog are held using the following container
-typedef vector<Collection> Catalog_container;
-
 // Records in the library are sorted by title with this comparison functor
 typedef Less_than_ptr<Record*> Title_compare;
 
-// Record IDs are compared using this functor
-struct ID_compare {
-    bool operator() (const Record *lhs, const Record *rhs) const { return lhs->get_ID() < rhs->get_ID(); }
+// Records with the same medium or rating are grouped in title order
+typedef Counted_record_set<INDEX_MEMORY> Record_group;
+typedef map<string, Record_group, less<string>, Counting_allocator<pair<const string, Record_group>, INDEX_MEMORY>> Medium_groups;
+typedef map<int, Record_group, less<int>, Counting_allocator<pair<const int, Record_group>, INDEX_MEMORY>> Rating_groups;
+
+// The keys records are looked up or grouped by
+struct Record_ID {
+    int operator()(const Record* record) const { return record->get_ID(); }
+};
+struct Record_medium {
+    const string& operator()(const Record* record) const { return record->get_medium(); }
+};
+struct Record_rating {
+    int operator()(const Record* record) const { return record->get_rating(); }
 };
 
+/* The library holds each record once under all of these indexes, which a single insert or erase keeps in step:
+ * in title order, by ID, and grouped by medium and by rating. Another index only needs declaring here.
+ */
+typedef Multi_index<
+    Sorted_index<Record_container, Title_compare>,
+    Table_index<ID_table, Record_ID>,
+    Grouped_index<Medium_groups, Record_medium>,
+    Grouped_index<Rating_groups, Record_rating>> Library;
+enum Library_index { BY_TITLE, BY_ID, BY_MEDIUM, BY_RATING };
+typedef Library::index_type<BY_TITLE> Title_index;
+
 // Struct holding the library and catalog information
 struct data_container {
-    Catalog_container catalog;
-    Record_container library_title;
-    Record_container library_id;
+    Catalog catalog;
+    Library library;
 };
 
+// How the command being processed has finished so far, for workload capture
+Result_class command_result = Result_class::OK;
+// The number of heap allocations made by the previous command
+unsigned long long previous_command_allocations = 0;
+
+// Generations of the library for the result cache: library_generation changes whenever records are added,
+// removed or changed, and record_generation whenever the title or rating of an existing record changes
+unsigned long long library_generation = 0;
+unsigned long long record_generation = 0;
+// Recent results of read-only commands, limited to this many results and bytes
+const size_t RESULT_CACHE_ENTRIES = 256;
+const size_t RESULT_CACHE_BYTES = 16 << 20;
+Result_cache result_cache(RESULT_CACHE_ENTRIES, RESULT_CACHE_BYTES);
+
+// Scans of the whole library over at least twice this many records are split into chunks of this many,
+// which run on the scan pool; the pool, and the parsing of imports, use one thread per core unless -threads gives a number
+const size_t SCAN_CHUNK_RECORDS = 4096;
+const unsigned MAX_SCAN_THREADS = 64;
+unsigned num_scan_threads = 0;
+
+// Where the changes made by commands are sent to replicas, if anywhere
+unique_ptr<Feed_writer> change_feed;
+// How long a starting replica waits for the feed to reach the snapshot it starts from
+const int REPLICA_START_WAIT_MS = 2000;
+
 /* Function pointer used in command map
  * Returns true if the user is finished, false otherwise
  */
 typedef bool (*data_container_func)(data_container&);
 
-/* lib cat helper functions dec */
+// The members of a collection in a partitioned library, as a map from ID to title
+typedef map<int, string> Partition_members;
+
+/* Struct holding a library partitioned across worker processes. The records live in the workers;
+ * the coordinator keeps which shard has each ID and the whole catalog, since a collection may
+ * have members on any shard, along with how many collections each record is a member of.
+ */
+struct partition_container {
+    partition_container(Partition& shards_) : shards(shards_) {}
+
+    Partition& shards;
+    unordered_map<int, int> ID_shards;
+    int last_ID = 0;
+    map<string, Partition_members> catalog;
+    unordered_map<int, int> membership_counts;
+};
+
+// Function pointer used in the command map of a partitioned library
+typedef bool (*partition_container_func)(partition_container&);
+
+// Struct holding a read-only replica of a library, kept up to date by applying the changes in a feed
+struct replica_container {
+    replica_container(Feed_reader& feed_) : feed(feed_) {}
+
+    data_container lib_cat;
+    Feed_reader& feed;
+    // why the replica stopped following the feed, if it has; its library no longer matches the primary's
+    // after that, so every command reports this instead of running
+    string failure;
+};
 
-// Performs a title-based lower_bound on the library for a given record
-Record_container::iterator lib_title_lower_bound(data_container& lib_cat, Record* record);
-// Performs an id-based lower_bound on the library for a given record
-Record_container::iterator lib_id_lower_bound(data_container& lib_cat, Record* record);
-// Performs a lower_bound on the catalog for a collection
-Catalog_container::iterator catalog_lower_bound(data_container& lib_cat, Collection& collection);
+// Function pointer used in the command map of a replica
+typedef bool (*replica_container_func)(replica_container&);
 
-// Read a title from stdin and then return an iterator to a record in the library with that title
-Record_container::iterator read_title_get_iter(data_container& lib_cat);
-// Read an id from stdin and then return an iterator to a record in the library with that id
-Record_container::iterator read_id_get_iter(data_container& lib_cat);
-// Read a name from stdin and then return an iterator to a collection in the catalog with that name
-Catalog_container::iterator read_name_get_iter(data_container& lib_cat);
+/* command loop dec */
 
-// Checks if the provided title is already in the library
-void check_title_in_library(data_container& lib_cat, string title);
+// Runs commands from stdin until one finishes the program. A partition worker marks the end of each
+// command with WORKER_PROMPT and the command's Result_class instead of prompting, and stops at end of input.
+template<typename Container>
+void run_commands(Container& container, map<string, bool (*)(Container&)>& function_map, Capture_session* capture, bool worker);
+// Returns the command map for a library held in this process
+map<string, data_container_func> library_commands();
+// Returns the command map for a library partitioned across worker processes
+map<string, partition_container_func> partition_commands();
+// Returns the command map for a replica
+map<string, replica_container_func> replica_commands();
+// Runs the command loop of a partition worker on its part of the library
+int serve_worker();
+
+/* lib cat helper functions dec */
+
+/* Lookups do not throw when nothing is found, since a miss is an ordinary result for many commands;
+ * they return nullptr instead and the command reports the miss with report_error or report_error_no_clear.
+ */
+// Returns a pointer to the record in the library with the given title, or nullptr if there is none
+Record* find_title(data_container& lib_cat, const string& title);
+// Read a title from stdin and then return a pointer to the record in the library with that title, or nullptr
+Record* read_title_get_record(data_container& lib_cat);
+// Read an id from stdin and then return a pointer to the record in the library with that id, or nullptr
+Record* read_id_get_record(data_container& lib_cat);
+// Read a name from stdin and then return a pointer to the collection in the catalog with that name, or nullptr
+Collection* read_name_get_collection(data_container& lib_cat);
 
 // Inserts a record into the library and returns a pointer to the inserted record
 Record* insert_record(data_container& lib_cat, Record* record);
+// Inserts a group of new records into the library at once
+void insert_records(data_container& lib_cat, Record_container& records);
+// Removes a record from the library without deleting it
+void remove_record(data_container& lib_cat, Record* record);
 // Inserts a collection into the catalog
 void insert_collection(data_container& lib_cat, Collection&& collection);
 
 // Clears the library and its data
 void clear_library_data(data_container& lib_cat);
+// Clears the catalog and then the library, and resets the ID counter
+void clear_all_data(data_container& lib_cat);
+// Changes the rating or title of a record in the library and in the collections it belongs to
+void change_rating(data_container& lib_cat, Record* record, int rating);
+void change_title(data_container& lib_cat, Record* record, const string& title);
+// Replaces the library and catalog with those saved in a file. Throw Error exception if the file is invalid.
+void restore_data(data_container& lib_cat, const string& filename);
+// Sends the whole library and catalog to the change feed, as if they had just been added
+void feed_all_data(data_container& lib_cat);
 
 /* other functions dec */
 
+// Prints an error message and clears the rest of the line, as main does for an Error exception; returns false
+bool report_error(const char* msg);
+// Prints an error message, as main does for an ErrorNoClear exception; returns false
+bool report_error_no_clear(const char* msg);
 // Reads a title from stdin
 string title_read(istream &is);
-// Processes a string and removes excess whitespace
-string parse_title(string& title_string);
 // Reads an integer from stdin and throws an error if it fails
 int integer_read();
+// Converts a string to all lowercase
+string string_to_lower(string original);
+// Returns the result of a read-only command from the result cache if it is up to date with the given generations;
+// otherwise calls format to write the result, stores it in the cache, and returns it
+const string& cached_result(const string& key, const Cache_generations& generations, const function<void (ostream&)>& format);
+// Returns the pool that runs the chunks of large scans, starting it the first time
+Task_pool& scan_pool();
+/* Writes count items to os with format(begin, end, chunk_os), which writes items begin up to end to chunk_os.
+ * A large count is split into chunks that are formatted on the scan pool, each into its own buffer,
+ * and the buffers are written in order, so the output is the same as writing all the items in one go.
+ */
+void parallel_format(size_t count, ostream& os, const function<void (size_t, size_t, ostream&)>& format);
 
 /* main lib cat functions dec */
 
 bool find_record(data_container& lib_cat);
 bool find_string(data_container& lib_cat);
+bool find_query(data_container& lib_cat);
 
 bool list_ratings(data_container& lib_cat);
 
@@ -98,40 +239,311 @@ bool print_collection(data_container& lib_cat);
 bool print_library(data_container& lib_cat);
 bool print_catalog(data_container& lib_cat);
 bool print_allocation(data_container& lib_cat);
+bool print_heap_allocations(data_container& lib_cat);
+bool print_result_cache(data_container& lib_cat);
+bool print_feed(data_container& lib_cat);
 
 bool collection_statistics(data_container& lib_cat);
 bool combine_collections(data_container& lib_cat);
+bool find_similar_collections(data_container& lib_cat);
 
 bool modify_rating(data_container& lib_cat);
 bool modify_title(data_container& lib_cat);
 
 bool add_record(data_container& lib_cat);
+bool import_records(data_container& lib_cat);
 bool add_collection(data_container& lib_cat);
 bool add_member(data_container& lib_cat);
+bool add_members(data_container& lib_cat);
 
 bool delete_record(data_container& lib_cat);
 bool delete_collection(data_container& lib_cat);
 bool delete_member(data_container& lib_cat);
+bool delete_members(data_container& lib_cat);
 
 bool clear_library(data_container& lib_cat);
 bool clear_catalog(data_container& lib_cat);
 bool clear_all(data_container& lib_cat);
 
 bool save_all(data_container& lib_cat);
+bool export_all(data_container& lib_cat);
+// Saves the trace spans recorded so far to a file; this works the same for any kind of library
+template<typename Container>
+bool save_trace(Container& container);
 
 bool restore_all(data_container& lib_cat);
 
 bool quit(data_container& lib_cat);
 
+// Adds a record with an ID assigned by the coordinator of a partitioned library; only workers have this command
+bool add_record_with_ID(data_container& lib_cat);
+
+/* partitioned lib cat functions dec */
+
+// Prints a worker's reply as the reply to the current command, clearing the rest of the line after an error
+bool forward_reply(const Worker_reply& reply);
+// Returns the record lines in a worker's output, after skipping the given number of lines
+vector<Record_line> reply_record_lines(const string& output, size_t skip);
+// Returns the record lines for the given IDs, fetched from their shards all at once
+map<int, Record_line> fetch_record_lines(partition_container& partition, const vector<int>& IDs);
+// Prints a collection as Collection's output operator does, with the given record lines
+void print_partition_collection(const string& name, const Partition_members& members, map<int, Record_line>& record_lines);
+// Read a name from stdin and then return a pointer to the members of the collection with that name, or nullptr
+Partition_members* read_name_get_partition_members(partition_container& partition);
+// Read an id from stdin and then return it if a shard has a record with that id, or 0
+int read_id_get_partition_ID(partition_container& partition);
+// Update the count of collections the record with an ID is a member of
+void count_partition_member(partition_container& partition, int ID);
+void uncount_partition_member(partition_container& partition, int ID);
+// Returns the record lines of the whole library in title order, gathered from all the shards
+vector<Record_line> partition_library_lines(partition_container& partition);
+// Replaces the library and catalog with those saved in a file, choosing the shard ranges again for the saved titles.
+// Throw Error exception if the file is invalid, before any shard is changed.
+void restore_partition_data(partition_container& partition, const string& filename);
+
+bool partition_find_record(partition_container& partition);
+bool partition_find_string(partition_container& partition);
+bool partition_list_ratings(partition_container& partition);
+bool partition_print_record(partition_container& partition);
+bool partition_print_collection(partition_container& partition);
+bool partition_print_library(partition_container& partition);
+bool partition_print_catalog(partition_container& partition);
+bool partition_print_allocation(partition_container& partition);
+bool partition_collection_statistics(partition_container& partition);
+bool partition_combine_collections(partition_container& partition);
+bool partition_modify_rating(partition_container& partition);
+bool partition_modify_title(partition_container& partition);
+bool partition_add_record(partition_container& partition);
+bool partition_add_collection(partition_container& partition);
+bool partition_add_member(partition_container& partition);
+bool partition_add_members(partition_container& partition);
+bool partition_delete_record(partition_container& partition);
+bool partition_delete_collection(partition_container& partition);
+bool partition_delete_member(partition_container& partition);
+bool partition_delete_members(partition_container& partition);
+bool partition_clear_library(partition_container& partition);
+bool partition_clear_catalog(partition_container& partition);
+bool partition_clear_all(partition_container& partition);
+bool partition_save_all(partition_container& partition);
+bool partition_restore_all(partition_container& partition);
+bool partition_quit(partition_container& partition);
+// Reports that a command needs the whole library in one process
+bool partition_unsupported(partition_container& partition);
+
+/* replica lib cat functions dec */
+
+// Loads the library saved in a snapshot file and applies the changes the feed has after the snapshot was saved.
+// Throw Error exception if the snapshot cannot be loaded or the feed has no record of it.
+void start_replica(replica_container& replica, const string& snapshot_filename);
+// Applies the changes of the commands committed to the feed since the last time.
+// Throw Error exception if the replica has stopped following the feed, now or before.
+void apply_feed(replica_container& replica);
+// Applies changes to the library; if one does not fit, the replica stops following the feed for good
+void apply_changes(replica_container& replica, vector<Feed_change>::const_iterator first, vector<Feed_change>::const_iterator last);
+// Applies one change to the library. Throw Error exception if it does not fit the library.
+void apply_change(data_container& lib_cat, const Feed_change& change);
+// Brings the replica up to date with the feed and then runs a read-only command on its library
+template<bool (*Command)(data_container&)>
+bool replica_command(replica_container& replica);
+bool replica_print_feed(replica_container& replica);
+// Reports that a command would change the library, which only the primary may do
+bool replica_read_only(replica_container& replica);
+// Quits without bringing the replica up to date, since nothing more is shown from it
+bool replica_quit(replica_container& replica);
+
 /* main */
 
-int main()
+int main(int argc, char* argv[])
 {
+    // with -capture, every command is recorded into the named trace file;
+    // with -shards, the library is partitioned across that many worker processes;
+    // with -feed, every change to the library is sent to the named file or pipe;
+    // with -replica, the library starts from a snapshot and follows a feed, and cannot be changed otherwise;
+    // with -threads, large scans of the library and imports run on that many threads instead of one per core;
+    // with -title-budget, long titles are kept on disk, with at most that many bytes of them in memory
+    string capture_filename, feed_path, snapshot_filename, replica_feed_path;
+    int num_shards = 0;
+    long long title_budget = -1;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i)
+    {
+        string argument = argv[i];
+        if (argument == "-capture" && i + 1 < argc)
+        {
+            capture_filename = argv[++i];
+        } else if (argument == "-shards" && i + 1 < argc && (num_shards = atoi(argv[++i])) >= 1 && num_shards <= MAX_SHARDS)
+        {
+            continue;
+        } else if (argument == "-threads" && i + 1 < argc && (num_scan_threads = atoi(argv[++i])) >= 1
+            && num_scan_threads <= MAX_SCAN_THREADS)
+        {
+            continue;
+        } else if (argument == "-title-budget" && i + 1 < argc && (title_budget = atoll(argv[++i])) >= 0)
+        {
+            continue;
+        } else if (argument == "-feed" && i + 1 < argc)
+        {
+            feed_path = argv[++i];
+        } else if (argument == "-replica" && i + 2 < argc)
+        {
+            snapshot_filename = argv[++i];
+            replica_feed_path = argv[++i];
+        } else
+        {
+            valid = false;
+        }
+    }
+    // a library is partitioned, sends a feed, or follows one, but only one of these;
+    // the title store is for a library held in this process, so it cannot be partitioned
+    if (!valid || (num_shards > 0) + !feed_path.empty() + !replica_feed_path.empty() > 1 || (num_shards > 0 && title_budget >= 0))
+    {
+        cerr << "Usage: " << argv[0] << " [-capture trace_file] [-shards 1-" << MAX_SHARDS
+            << " | -feed feed_file | -replica snapshot_file feed_file] [-threads 1-" << MAX_SCAN_THREADS
+            << "] [-title-budget bytes]\n";
+        return 1;
+    }
+    if (num_scan_threads == 0)
+    {
+        num_scan_threads = thread::hardware_concurrency();
+    }
+    try
+    {
+        // the workers are started before any other threads, since a forked process only has the thread that forked it
+        unique_ptr<Partition> partition;
+        if (num_shards > 0)
+        {
+            partition.reset(new Partition(num_shards, serve_worker));
+        }
+        // output is written on a separate thread; this is set up before capture so that a capture session
+        // records the output on its way in, and all output is written before the program ends
+        Async_output async_output(cout);
+        // the store is made before any record, and outlives them all
+        unique_ptr<Title_store> title_store;
+        if (title_budget >= 0)
+        {
+            title_store.reset(new Title_store(title_budget));
+            Record::set_title_store(title_store.get());
+        }
+        unique_ptr<Capture_session> capture;
+        if (!capture_filename.empty())
+        {
+            capture.reset(new Capture_session(cin, cout, capture_filename));
+        }
+        if (partition)
+        {
+            partition_container partitioned_lib_cat(*partition);
+            map<string, partition_container_func> function_map = partition_commands();
+            run_commands(partitioned_lib_cat, function_map, capture.get(), false);
+        } else if (!replica_feed_path.empty())
+        {
+            Feed_reader feed(replica_feed_path);
+            replica_container replica(feed);
+            start_replica(replica, snapshot_filename);
+            map<string, replica_container_func> function_map = replica_commands();
+            run_commands(replica, function_map, capture.get(), false);
+        } else
+        {
+            if (!feed_path.empty())
+            {
+                change_feed.reset(new Feed_writer(feed_path));
+            }
+            data_container lib_cat;
+            map<string, data_container_func> function_map = library_commands();
+            run_commands(lib_cat, function_map, capture.get(), false);
+        }
+    } catch (Error& e)
+    {
+        cerr << e.msg << "\n";
+        return 1;
+    }
+    return 0;
+}
 
-    data_container lib_cat;
-    map<string, data_container_func> function_map {
+/* command loop impl */
+
+// Runs commands from stdin until one finishes the program. A partition worker marks the end of each
+// command with WORKER_PROMPT and the command's Result_class instead of prompting, and stops at end of input.
+template<typename Container>
+void run_commands(Container& container, map<string, bool (*)(Container&)>& function_map, Capture_session* capture, bool worker)
+{
+    Result_class previous_result = Result_class::OK;
+    bool done = false;
+    while (!done)
+    {
+        command_result = Result_class::OK;
+        unsigned long long command_start_allocations = heap_allocation_count();
+        try
+        {
+            char action, object;
+            if (worker)
+            {
+                cout << WORKER_PROMPT << static_cast<char>(previous_result);
+            } else
+            {
+                cout << "\nEnter command: ";
+            }
+            if (capture)
+            {
+                capture->begin_command();
+            }
+            if (!(cin >> action >> object))
+            {
+                if (worker && cin.eof())
+                {
+                    break;
+                }
+                throw Error(UNRECOGNIZED_MSG);
+            }
+            if (capture)
+            {
+                capture->command_arrived();
+            }
+            string command;
+            command += action;
+            command += object;
+            if (function_map.find(command) == function_map.end())
+            {
+                throw Error(UNRECOGNIZED_MSG);
+            }
+            TRACE_SPAN("command", command);
+            done = function_map[command](container);
+        } catch (Error& e) {
+            report_error(e.msg);
+        } catch (ErrorNoClear& e)
+        {
+            report_error_no_clear(e.msg);
+        } catch (...)
+        {
+            // print error message
+            done = true;
+        }
+        // whatever the command changed goes to the feed, even if it failed partway
+        if (change_feed)
+        {
+            try
+            {
+                change_feed->commit();
+            } catch (Error& e)
+            {
+                report_error_no_clear(e.msg);
+            }
+        }
+        previous_command_allocations = heap_allocation_count() - command_start_allocations;
+        previous_result = command_result;
+        if (capture)
+        {
+            capture->end_command(done ? Result_class::QUIT : command_result);
+        }
+    }
+}
+
+// Returns the command map for a library held in this process
+map<string, data_container_func> library_commands()
+{
+    return {
             {"fr", find_record},
             {"fs", find_string},
+            {"fq", find_query},
 
             {"lr", list_ratings},
 
@@ -140,180 +552,367 @@ int main()
             {"pL", print_library},
             {"pC", print_catalog},
             {"pa", print_allocation},
+            {"ph", print_heap_allocations},
+            {"pq", print_result_cache},
+            {"pf", print_feed},
 
             {"cs", collection_statistics},
             {"cc", combine_collections},
+            {"fc", find_similar_collections},
 
             {"mr", modify_rating},
             {"mt", modify_title},
 
             {"ar", add_record},
+            {"ir", import_records},
             {"ac", add_collection},
             {"am", add_member},
+            {"aM", add_members},
 
             {"dr", delete_record},
             {"dc", delete_collection},
             {"dm", delete_member},
+            {"dM", delete_members},
 
             {"cL", clear_library},
             {"cC", clear_catalog},
             {"cA", clear_all},
 
             {"sA", save_all},
+            {"eA", export_all},
+            {"sT", save_trace<data_container>},
 
             {"rA", restore_all},
 
             {"qq", quit}
     };
-    while (true)
-    {
-        try
-        {
-            char action, object;
-            cout << "\nEnter command: ";
-            if (!(cin >> action >> object))
-            {
-                throw Error(UNRECOGNIZED_MSG);
-            }
-            string command;
-            command += action;
-            command += object;
-            if (function_map.find(command) == function_map.end())
-            {
-                throw Error(UNRECOGNIZED_MSG);
-            }
-            if (function_map[command](lib_cat))
-            {
-                return 0;
-            }
-        } catch (Error& e) {
-            cout << e.msg << "\n";
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        } catch (ErrorNoClear& e)
-        {
-            cout << e.msg << "\n";
-        } catch (...)
-        {
-            // print error message
-            return 0;
-        }
-    }
 }
 
-/* lib cat helper functions impl */
-
-// Performs a title-based lower_bound on the library for a given record
-Record_container::iterator lib_title_lower_bound(data_container& lib_cat, Record* record)
+// Returns the command map for a library partitioned across worker processes
+map<string, partition_container_func> partition_commands()
 {
-    return lower_bound(lib_cat.library_title.begin(), lib_cat.library_title.end(), record, Title_compare());
+    return {
+            {"fr", partition_find_record},
+            {"fs", partition_find_string},
+            {"fq", partition_unsupported},
+
+            {"lr", partition_list_ratings},
+
+            {"pr", partition_print_record},
+            {"pc", partition_print_collection},
+            {"pL", partition_print_library},
+            {"pC", partition_print_catalog},
+            {"pa", partition_print_allocation},
+            {"ph", partition_unsupported},
+            {"pq", partition_unsupported},
+            {"pf", partition_unsupported},
+
+            {"cs", partition_collection_statistics},
+            {"cc", partition_combine_collections},
+            {"fc", partition_unsupported},
+
+            {"mr", partition_modify_rating},
+            {"mt", partition_modify_title},
+
+            {"ar", partition_add_record},
+            {"ir", partition_unsupported},
+            {"ac", partition_add_collection},
+            {"am", partition_add_member},
+            {"aM", partition_add_members},
+
+            {"dr", partition_delete_record},
+            {"dc", partition_delete_collection},
+            {"dm", partition_delete_member},
+            {"dM", partition_delete_members},
+
+            {"cL", partition_clear_library},
+            {"cC", partition_clear_catalog},
+            {"cA", partition_clear_all},
+
+            {"sA", partition_save_all},
+            {"eA", partition_unsupported},
+            {"sT", save_trace<partition_container>},
+
+            {"rA", partition_restore_all},
+
+            {"qq", partition_quit}
+    };
 }
-// Performs an id-based lower_bound on the library for a given record
-Record_container::iterator lib_id_lower_bound(data_container& lib_cat, Record* record)
+
+// Returns the command map for a replica
+map<string, replica_container_func> replica_commands()
 {
-    return lower_bound(lib_cat.library_id.begin(), lib_cat.library_id.end(), record, ID_compare());
+    return {
+            {"fr", replica_command<find_record>},
+            {"fs", replica_command<find_string>},
+            {"fq", replica_command<find_query>},
+
+            {"lr", replica_command<list_ratings>},
+
+            {"pr", replica_command<print_record>},
+            {"pc", replica_command<print_collection>},
+            {"pL", replica_command<print_library>},
+            {"pC", replica_command<print_catalog>},
+            {"pa", replica_command<print_allocation>},
+            {"ph", replica_command<print_heap_allocations>},
+            {"pq", replica_command<print_result_cache>},
+            {"pf", replica_print_feed},
+
+            {"cs", replica_command<collection_statistics>},
+            {"cc", replica_read_only},
+            {"fc", replica_command<find_similar_collections>},
+
+            {"mr", replica_read_only},
+            {"mt", replica_read_only},
+
+            {"ar", replica_read_only},
+            {"ir", replica_read_only},
+            {"ac", replica_read_only},
+            {"am", replica_read_only},
+            {"aM", replica_read_only},
+
+            {"dr", replica_read_only},
+            {"dc", replica_read_only},
+            {"dm", replica_read_only},
+            {"dM", replica_read_only},
+
+            {"cL", replica_read_only},
+            {"cC", replica_read_only},
+            {"cA", replica_read_only},
+
+            {"sA", replica_command<save_all>},
+            {"eA", replica_command<export_all>},
+            {"sT", save_trace<replica_container>},
+
+            {"rA", replica_read_only},
+
+            {"qq", replica_quit}
+    };
 }
-// Performs a lower_bound on the catalog for a collection
-Catalog_container::iterator catalog_lower_bound(data_container& lib_cat, Collection& collection)
+
+// Runs the command loop of a partition worker on its part of the library
+int serve_worker()
 {
-    return lower_bound(lib_cat.catalog.begin(), lib_cat.catalog.end(), collection);
+    data_container lib_cat;
+    map<string, data_container_func> function_map = library_commands();
+    function_map["xa"] = add_record_with_ID;
+    run_commands(lib_cat, function_map, nullptr, true);
+    return 0;
 }
 
-// Read a title from stdin and then return an iterator to a record in the library with that title
-Record_container::iterator read_title_get_iter(data_container& lib_cat)
+/* lib cat helper functions impl */
+
+// Returns a pointer to the record in the library with the given title, or nullptr if there is none
+Record* find_title(data_container& lib_cat, const string& title)
 {
-    string title = title_read(cin);
+    TRACE_SPAN("title_find");
     Record temp_record(title);
-    auto record_iter = lib_title_lower_bound(lib_cat, &temp_record);
-    if (record_iter == lib_cat.library_title.end() || **record_iter != temp_record)
-    {
-        throw ErrorNoClear("No record with that title!");
-    }
-    return record_iter;
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    auto record_iter = titles.find(&temp_record);
+    return record_iter == titles.end() ? nullptr : *record_iter;
 }
-// Read an id from stdin and then return an iterator to a record in the library with that id
-Record_container::iterator read_id_get_iter(data_container& lib_cat)
+// Read a title from stdin and then return a pointer to the record in the library with that title, or nullptr
+Record* read_title_get_record(data_container& lib_cat)
 {
-    int id = integer_read();
-    Record temp_record(id);
-    auto record_iter = lib_id_lower_bound(lib_cat, &temp_record);
-    if (record_iter == lib_cat.library_id.end() || **record_iter != temp_record)
-    {
-        throw Error("No record with that ID!");
-    }
-    return record_iter;
+    return find_title(lib_cat, title_read(cin));
+}
+// Read an id from stdin and then return a pointer to the record in the library with that id, or nullptr
+Record* read_id_get_record(data_container& lib_cat)
+{
+    int ID = integer_read();
+    TRACE_SPAN("id_find");
+    return lib_cat.library.get<BY_ID>().find(ID);
 }
-// Read a name from stdin and then return an iterator to a collection in the catalog with that name
-Catalog_container::iterator read_name_get_iter(data_container& lib_cat)
+// Read a name from stdin and then return a pointer to the collection in the catalog with that name, or nullptr
+Collection* read_name_get_collection(data_container& lib_cat)
 {
     string name;
     cin >> name;
-    Collection temp_collection(name);
-    auto collection_iter = catalog_lower_bound(lib_cat, temp_collection);
-    if (collection_iter == lib_cat.catalog.end() || *collection_iter != temp_collection)
-    {
-        throw Error("No collection with that name!");
-    }
-    return collection_iter;
+    return lib_cat.catalog.find(name);
 }
 
-// Checks if the provided title is already in the library
-void check_title_in_library(data_container& lib_cat, string title)
+// Inserts a record into the library and returns a pointer to the inserted record
+Record* insert_record(data_container& lib_cat, Record* record)
 {
-    Record temp_record(title);
-    auto title_check = lib_title_lower_bound(lib_cat, &temp_record);
-    if (title_check != lib_cat.library_title.end() && **title_check == temp_record)
+    ++library_generation;
+    try
+    {
+        lib_cat.library.insert(record);
+    } catch (...)
     {
-        throw ErrorNoClear("Library already has a record with this title!");
+        delete record;
+        throw;
     }
+    return record;
 }
 
-// Inserts a record into the library and returns a pointer to the inserted record
-Record* insert_record(data_container& lib_cat, Record* record)
+// Inserts a group of new records into the library at once
+void insert_records(data_container& lib_cat, Record_container& records)
 {
-    auto title_lower_bound = lib_title_lower_bound(lib_cat, record);
+    ++library_generation;
     try
     {
-        lib_cat.library_title.insert(title_lower_bound, record);
+        lib_cat.library.insert(records.begin(), records.end());
     } catch (...)
     {
-        delete record;
+        for_each(records.begin(), records.end(), [](Record* record) { delete record; });
         throw;
     }
+}
+// Removes a record from the library without deleting it
+void remove_record(data_container& lib_cat, Record* record)
+{
+    ++library_generation;
+    assert(lib_cat.library.get<BY_ID>().find(record->get_ID()) == record);
+    lib_cat.library.erase(record);
+}
+
+// Inserts a collection into the catalog
+void insert_collection(data_container& lib_cat, Collection&& collection)
+{
+    lib_cat.catalog.insert(move(collection));
+}
+
+// Clears the library and its data
+void clear_library_data(data_container& lib_cat)
+{
+    ++library_generation;
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    for_each(titles.begin(), titles.end(), [](Record* record) { delete record; });
+    lib_cat.library.clear();
+}
+// Clears the catalog and then the library, and resets the ID counter
+void clear_all_data(data_container& lib_cat)
+{
+    Record::reset_ID_counter();
+    // the collections must go first, since they refer to the records
+    lib_cat.catalog.clear();
+    clear_library_data(lib_cat);
+}
+
+// Changes the rating or title of a record in the library and in the collections it belongs to
+void change_rating(data_container& lib_cat, Record* record, int rating)
+{
+    // the rating is checked first, so that the record never leaves the indexes for a rating it cannot have
+    Record::check_rating(rating);
+    // only the rating groups depend on the rating
+    lib_cat.library.modify<BY_RATING>(record, [rating](Record* changed) { changed->set_rating(rating); });
+    ++library_generation;
+    ++record_generation;
+}
+void change_title(data_container& lib_cat, Record* record, const string& title)
+{
+    // the new title goes into the title store, if it can fail to, before anything is changed
+    Record::Staged_title staged = Record::stage_title(title);
+    list<Collection*> collections_with_record;
+    for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), [&collections_with_record, record](Collection* collection)
+        { if (collection->is_member_present(record)) { collections_with_record.push_back(collection); }});
+
+    // the collections are ordered by title, so the record leaves them while its title changes
+    for_each(collections_with_record.begin(), collections_with_record.end(), [&lib_cat, record](Collection* collection)
+        { lib_cat.catalog.remove_member(*collection, record); });
+
+    // change the record's title, which cannot fail now, and move it in every index ordered by title
+    ++library_generation;
+    ++record_generation;
     try
     {
-        lib_cat.library_id.insert(lib_id_lower_bound(lib_cat, record), record);
+        lib_cat.library.modify<BY_TITLE, BY_MEDIUM, BY_RATING>(record, [&staged](Record* changed) { changed->set_title(staged); });
     } catch (...)
     {
-        // if this insertion fails, we need to remove the record from the other container!
-        lib_cat.library_title.erase(title_lower_bound);
+        // a record that could not be put back is no longer in the library, and no collection holds it
         delete record;
         throw;
     }
-    return record;
+
+    // add the record back into all the collections it was in
+    for_each(collections_with_record.begin(), collections_with_record.end(), [&lib_cat, record](Collection* collection)
+        { lib_cat.catalog.add_member(*collection, record); });
 }
 
-// Inserts a collection into the catalog
-void insert_collection(data_container& lib_cat, Collection&& collection)
+// Replaces the library and catalog with those saved in a file. Throw Error exception if the file is invalid.
+void restore_data(data_container& lib_cat, const string& filename)
 {
-    auto collection_iter = catalog_lower_bound(lib_cat, collection);
-    if (collection_iter != lib_cat.catalog.end() && *collection_iter == collection)
+    ifstream file(filename.c_str());
+    if (!file)
     {
-        throw Error("Catalog already has a collection with this name!");
+        throw Error(FILE_OPEN_FAIL_MSG);
+    }
+    int num_records;
+    if (!(file >> num_records))
+    {
+        throw Error(FILE_ERROR_MSG);
+    }
+    data_container new_lib_cat;
+    try
+    {
+        Record::save_ID_counter();
+        Record::reset_ID_counter();
+        {
+            TRACE_SPAN("restore_records");
+            for (int i = 0; i < num_records; i++)
+            {
+                insert_record(new_lib_cat, new Record(file));
+            }
+        }
+        int num_collections;
+        if (!(file >> num_collections))
+        {
+            throw Error(FILE_ERROR_MSG);
+
+        }
+        for (int i = 0; i < num_collections; i++)
+        {
+            TRACE_SPAN("restore_collection");
+            insert_collection(new_lib_cat, Collection(file, new_lib_cat.library.get<BY_TITLE>().get_elements()));
+        }
+        // swap the new data in, then discard the old data, collections first since they refer to the records
+        swap(lib_cat, new_lib_cat);
+        new_lib_cat.catalog.clear();
+        clear_library_data(new_lib_cat);
+    }
+    catch (Error& e)
+    {
+        new_lib_cat.catalog.clear();
+        clear_library_data(new_lib_cat);
+        Record::restore_ID_counter();
+        throw Error(FILE_ERROR_MSG);
     }
-    lib_cat.catalog.insert(collection_iter, collection);
 }
 
-// Clears the library and its data
-void clear_library_data(data_container& lib_cat)
+// Sends the whole library and catalog to the change feed, as if they had just been added
+void feed_all_data(data_container& lib_cat)
 {
-    for_each(lib_cat.library_title.begin(), lib_cat.library_title.end(), [](Record* record) { delete record; });
-    lib_cat.library_title.clear();
-    lib_cat.library_id.clear();
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    for_each(titles.begin(), titles.end(), [](Record* record)
+        { change_feed->record_added(record->get_ID(), record->get_rating(), record->get_medium(), record->get_title()); });
+    for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), [](Collection* collection)
+    {
+        change_feed->collection_added(collection->get_name());
+        for_each(collection->begin(), collection->end(), [collection](Record* record)
+            { change_feed->member_added(collection->get_name(), record->get_ID()); });
+    });
 }
 
 /* other functions impl */
 
+// Prints an error message and clears the rest of the line, as main does for an Error exception; returns false
+bool report_error(const char* msg)
+{
+    command_result = Result_class::ERROR;
+    cout << msg << "\n";
+    cin.clear();
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    return false;
+}
+// Prints an error message, as main does for an ErrorNoClear exception; returns false
+bool report_error_no_clear(const char* msg)
+{
+    command_result = Result_class::ERROR_NO_CLEAR;
+    cout << msg << "\n";
+    return false;
+}
+
 // Reads a title from stdin
 string title_read(istream &is)
 {
@@ -327,48 +926,6 @@ string title_read(istream &is)
     }
     return title;
 }
-// functor used to parse a string and remove excess whitespace
-struct title_parser
-{
-    void operator()(char c)
-    {
-        if (!isspace(c))
-        {
-            title.push_back(c);
-            remove_whitespace = false;
-        } else
-        {
-            /* if remove_whitespace is false, the last character read must not have been whitespace and we need
-             * a space, otherwise do not add this character to the string
-             */
-            if (!remove_whitespace)
-            {
-                title.push_back(' ');
-            }
-            remove_whitespace = true;
-        }
-    }
-    // removes terminating whitespace from processed string
-    void finalize()
-    {
-        if (isspace(title.back()))
-        {
-            title.pop_back();
-        }
-    }
-    string get_title() { return title; }
-private:
-    string title;
-    bool remove_whitespace = true;
-};
-// Processes a string and removes excess whitespace
-string parse_title(string& original)
-{
-    title_parser title_helper;
-    title_helper = for_each(original.begin(), original.end(), title_helper);
-    title_helper.finalize();
-    return title_helper.get_title();
-}
 // Reads an integer from stdin and throws an error if it fails
 int integer_read()
 {
@@ -379,94 +936,431 @@ int integer_read()
     }
     return integer;
 }
-
-/* main lib cat functions impl */
-
-bool find_record(data_container& lib_cat)
+// Converts a string to all lowercase
+string string_to_lower(string original)
 {
-    auto record_ptr = *read_title_get_iter(lib_cat);
-    cout << *record_ptr << "\n";
-    return false;
+    transform(original.begin(), original.end(), original.begin(), ::tolower);
+    return original;
 }
-// functor used to find records with titles containing a string
+// Returns the result of a read-only command from the result cache if it is up to date with the given generations;
+// otherwise calls format to write the result, stores it in the cache, and returns it
+const string& cached_result(const string& key, const Cache_generations& generations, const function<void (ostream&)>& format)
+{
+    if (const string* result = result_cache.find(key, generations))
+    {
+        return *result;
+    }
+    // the result is kept here as well, since it may be too big for the cache
+    static string computed;
+    ostringstream os;
+    format(os);
+    computed = os.str();
+    result_cache.insert(key, generations, computed);
+    return computed;
+}
+// Returns the pool that runs the chunks of large scans, starting it the first time
+Task_pool& scan_pool()
+{
+    static Task_pool pool(num_scan_threads);
+    return pool;
+}
+/* Writes count items to os with format(begin, end, chunk_os), which writes items begin up to end to chunk_os.
+ * A large count is split into chunks that are formatted on the scan pool, each into its own buffer,
+ * and the buffers are written in order, so the output is the same as writing all the items in one go.
+ */
+void parallel_format(size_t count, ostream& os, const function<void (size_t, size_t, ostream&)>& format)
+{
+    // the pool is not started until a scan is big enough to need it
+    if (count < 2 * SCAN_CHUNK_RECORDS || scan_pool().size() == 1)
+    {
+        format(0, count, os);
+        return;
+    }
+    vector<string> chunks((count + SCAN_CHUNK_RECORDS - 1) / SCAN_CHUNK_RECORDS);
+    scan_pool().run(chunks.size(), [count, &chunks, &format](size_t chunk_index)
+    {
+        TRACE_SPAN("scan_chunk");
+        size_t begin = chunk_index * SCAN_CHUNK_RECORDS;
+        ostringstream chunk_os;
+        format(begin, min(begin + SCAN_CHUNK_RECORDS, count), chunk_os);
+        chunks[chunk_index] = chunk_os.str();
+    });
+    for (string& chunk : chunks)
+    {
+        os << chunk;
+        // let each buffer go once written, so that they are not all held alongside the output
+        string().swap(chunk);
+    }
+}
+
+/* main lib cat functions impl */
+
+bool find_record(data_container& lib_cat)
+{
+    Record *record_ptr = read_title_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error_no_clear(NO_TITLE_MSG);
+    }
+    cout << *record_ptr << "\n";
+    return false;
+}
+// functor used to find records with titles containing a string
 struct string_finder
 {
     string_finder(string key_) : key(string_to_lower(key_)) {}
     void operator()(Record* record)
     {
-        string temp_title = string_to_lower(record->get_title());
+        // the lowercase title is built in a buffer kept from one record to the next
+        record->copy_title(temp_title);
+        transform(temp_title.begin(), temp_title.end(), temp_title.begin(), ::tolower);
         if (temp_title.find(key) != string::npos)
         {
             matching_records.push_back(record);
         }
     }
-    list<Record*> get_matches() { return matching_records; }
+    const list<Record*>& get_matches() const { return matching_records; }
 private:
     list<Record*> matching_records;
     string key;
-
-    // converts a string to all lowercase
-    static string string_to_lower(string original)
-    {
-        transform(original.begin(), original.end(), original.begin(), ::tolower);
-        return original;
-    }
+    string temp_title;
 };
 bool find_string(data_container& lib_cat)
 {
     string key;
     cin >> key;
-    string_finder string_helper(key);
-    string_helper = for_each(lib_cat.library_title.begin(), lib_cat.library_title.end(), string_helper);
-    list<Record*> matching_records = string_helper.get_matches();
-    if (matching_records.size() == 0)
+    // the search ignores case, so keys that differ only in case share a result
+    string lower_key = string_to_lower(key);
+    const string& matches = cached_result("fs " + lower_key, Cache_generations(library_generation, 0), [&lib_cat, &lower_key](ostream& os)
+    {
+        const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+        // each chunk of the library is searched by a finder of its own
+        parallel_format(titles.size(), os, [&titles, &lower_key](size_t begin, size_t end, ostream& chunk_os)
+        {
+            string_finder string_helper(lower_key);
+            // pass the finder by reference so that its list of matches is not copied in and out of for_each
+            for_each(titles.begin() + begin, titles.begin() + end, ref(string_helper));
+            const list<Record*>& matching_records = string_helper.get_matches();
+            ostream_iterator<Record*> out_it(chunk_os, "\n");
+            copy(matching_records.begin(), matching_records.end(), out_it);
+        });
+    });
+    if (matches.empty())
+    {
+        return report_error("No records contain that string!");
+    }
+    cout << matches;
+    return false;
+}
+
+// the conjunction of predicates that a record must satisfy to match a query
+struct Record_query
+{
+    vector<string> mediums;
+    int rating_min = 0, rating_max = INT_MAX;
+    int id_min = INT_MIN, id_max = INT_MAX;
+    bool has_rating = false, has_id = false;
+    // title prefixes, and lowercase substrings that the title must contain
+    vector<string> prefixes, keys;
+    vector<Collection*> collections;
+
+    // Returns true if the record satisfies every predicate, checking the cheapest ones first
+    bool matches(Record* record) const
+    {
+        if (record->get_ID() < id_min || record->get_ID() > id_max ||
+            record->get_rating() < rating_min || record->get_rating() > rating_max)
+        {
+            return false;
+        }
+        const string& medium = record->get_medium();
+        if (any_of(mediums.begin(), mediums.end(), [&medium](const string& m) { return m != medium; }) ||
+            any_of(collections.begin(), collections.end(), [record](Collection* c) { return !c->is_member_present(record); }))
+        {
+            return false;
+        }
+        if (any_of(prefixes.begin(), prefixes.end(), [record](const string& p) { return record->compare_title(0, p.size(), p) != 0; }))
+        {
+            return false;
+        }
+        if (keys.empty())
+        {
+            return true;
+        }
+        // the lowercase title is built in a buffer kept from one record to the next
+        record->copy_title(temp_title);
+        transform(temp_title.begin(), temp_title.end(), temp_title.begin(), ::tolower);
+        return none_of(keys.begin(), keys.end(), [this](const string& k) { return temp_title.find(k) == string::npos; });
+    }
+
+private:
+    mutable string temp_title;
+};
+/* Reads the predicates of a query from the rest of the line:
+ *   medium <medium>, rating <min> <max>, id <min> <max>, contains <string>, in <collection name>,
+ *   and prefix <title prefix>, which takes the rest of the line and so must come last
+ */
+Record_query query_read(data_container& lib_cat)
+{
+    string line;
+    getline(cin, line);
+    istringstream predicates(line);
+    Record_query query;
+    string predicate;
+    while (predicates >> predicate)
+    {
+        if (predicate == "medium")
+        {
+            string medium;
+            if (!(predicates >> medium))
+            {
+                throw ErrorNoClear(INVALID_QUERY_MSG);
+            }
+            query.mediums.push_back(medium);
+        } else if (predicate == "rating" || predicate == "id")
+        {
+            int low, high;
+            if (!(predicates >> low >> high))
+            {
+                throw ErrorNoClear(INVALID_QUERY_MSG);
+            }
+            bool is_rating = predicate == "rating";
+            (is_rating ? query.has_rating : query.has_id) = true;
+            int& query_min = is_rating ? query.rating_min : query.id_min;
+            int& query_max = is_rating ? query.rating_max : query.id_max;
+            query_min = max(query_min, low);
+            query_max = min(query_max, high);
+        } else if (predicate == "contains")
+        {
+            string key;
+            if (!(predicates >> key))
+            {
+                throw ErrorNoClear(INVALID_QUERY_MSG);
+            }
+            query.keys.push_back(string_to_lower(key));
+        } else if (predicate == "in")
+        {
+            string name;
+            if (!(predicates >> name))
+            {
+                throw ErrorNoClear(INVALID_QUERY_MSG);
+            }
+            Collection *collection_ptr = lib_cat.catalog.find(name);
+            if (!collection_ptr)
+            {
+                throw ErrorNoClear(NO_NAME_MSG);
+            }
+            query.collections.push_back(collection_ptr);
+        } else if (predicate == "prefix")
+        {
+            string raw_prefix;
+            getline(predicates, raw_prefix);
+            string prefix = parse_title(raw_prefix);
+            if (prefix.empty())
+            {
+                throw ErrorNoClear(INVALID_QUERY_MSG);
+            }
+            query.prefixes.push_back(prefix);
+        } else
+        {
+            throw ErrorNoClear(INVALID_QUERY_MSG);
+        }
+    }
+    return query;
+}
+/* Writes the records matching the query to the stream in title order and returns how many matched.
+ * The candidates come from whichever access path is expected to produce the fewest of them: the whole
+ * library, the title range sharing a prefix, a medium or rating group, an ID range, or a collection.
+ * The remaining predicates are checked against each candidate as it is reached.
+ */
+int query_execute(data_container& lib_cat, const Record_query& query, ostream& os)
+{
+    if (query.rating_min > query.rating_max || query.id_min > query.id_max)
+    {
+        return 0;
+    }
+    enum Access_path { LIBRARY, TITLE_PREFIX, MEDIUM, RATING, ID_RANGE, COLLECTION };
+    Access_path path = LIBRARY;
+    long long best_estimate = lib_cat.library.size();
+    auto consider = [&path, &best_estimate](Access_path candidate, long long estimate)
+        { if (estimate < best_estimate) { path = candidate; best_estimate = estimate; } };
+
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    auto prefix_begin = titles.begin(), prefix_end = titles.end();
+    if (!query.prefixes.empty())
+    {
+        const string& prefix = *max_element(query.prefixes.begin(), query.prefixes.end(),
+            [](const string& a, const string& b) { return a.size() < b.size(); });
+        prefix_begin = lower_bound(prefix_begin, prefix_end, prefix,
+            [](Record* r, const string& p) { return r->compare_title(0, string::npos, p) < 0; });
+        prefix_end = upper_bound(prefix_begin, prefix_end, prefix,
+            [](const string& p, Record* r) { return r->compare_title(0, p.size(), p) > 0; });
+        consider(TITLE_PREFIX, prefix_end - prefix_begin);
+    }
+    const Record_group *medium_group = nullptr;
+    for (auto& medium : query.mediums)
+    {
+        auto group_iter = lib_cat.library.get<BY_MEDIUM>().find(medium);
+        if (group_iter == lib_cat.library.get<BY_MEDIUM>().end())
+        {
+            return 0;
+        }
+        if (!medium_group || group_iter->second.size() < medium_group->size())
+        {
+            medium_group = &group_iter->second;
+        }
+    }
+    if (medium_group)
+    {
+        consider(MEDIUM, medium_group->size());
+    }
+    auto rating_first = lib_cat.library.get<BY_RATING>().lower_bound(query.rating_min);
+    auto rating_last = lib_cat.library.get<BY_RATING>().upper_bound(query.rating_max);
+    if (query.has_rating)
+    {
+        long long rating_estimate = 0;
+        for_each(rating_first, rating_last, [&rating_estimate](const Rating_groups::value_type& group) { rating_estimate += group.second.size(); });
+        consider(RATING, rating_estimate);
+    }
+    if (query.has_id)
+    {
+        consider(ID_RANGE, static_cast<long long>(query.id_max) - max(query.id_min, 1) + 1);
+    }
+    const Collection *smallest_collection = nullptr;
+    for (auto collection : query.collections)
+    {
+        if (!smallest_collection || collection->size() < smallest_collection->size())
+        {
+            smallest_collection = collection;
+        }
+    }
+    if (smallest_collection)
+    {
+        consider(COLLECTION, smallest_collection->size());
+    }
+
+    int num_matches = 0;
+    auto emit = [&query, &os, &num_matches](Record* record)
+        { if (query.matches(record)) { os << record << "\n"; ++num_matches; } };
+    Record_container candidates;
+    switch (path)
+    {
+        case LIBRARY:
+            for_each(titles.begin(), titles.end(), emit);
+            break;
+        case TITLE_PREFIX:
+            for_each(prefix_begin, prefix_end, emit);
+            break;
+        case MEDIUM:
+            for_each(medium_group->begin(), medium_group->end(), emit);
+            break;
+        case COLLECTION:
+            for_each(smallest_collection->begin(), smallest_collection->end(), emit);
+            break;
+        case RATING:
+            // a single rating group is already in title order; several have to be merged
+            if (rating_first != rating_last && next(rating_first) == rating_last)
+            {
+                for_each(rating_first->second.begin(), rating_first->second.end(), emit);
+                break;
+            }
+            for_each(rating_first, rating_last, [&candidates](const Rating_groups::value_type& group)
+                { candidates.insert(candidates.end(), group.second.begin(), group.second.end()); });
+            sort(candidates.begin(), candidates.end(), Title_compare());
+            for_each(candidates.begin(), candidates.end(), emit);
+            break;
+        case ID_RANGE:
+            for (int id = max(query.id_min, 1); id <= query.id_max; ++id)
+            {
+                if (Record *record_ptr = lib_cat.library.get<BY_ID>().find(id))
+                {
+                    candidates.push_back(record_ptr);
+                }
+                if (id == INT_MAX)
+                {
+                    break;
+                }
+            }
+            sort(candidates.begin(), candidates.end(), Title_compare());
+            for_each(candidates.begin(), candidates.end(), emit);
+            break;
+    }
+    return num_matches;
+}
+bool find_query(data_container& lib_cat)
+{
+    Record_query query = query_read(lib_cat);
+    if (query_execute(lib_cat, query, cout) == 0)
     {
-        throw Error("No records contain that string!");
+        return report_error_no_clear("No records match that query!");
     }
-    ostream_iterator<Record*> out_it(cout, "\n");
-    copy(matching_records.begin(), matching_records.end(), out_it);
     return false;
 }
 
 bool list_ratings(data_container& lib_cat)
 {
-    if (lib_cat.library_title.empty())
+    if (lib_cat.library.empty())
     {
         cout << LIBRARY_EMPTY_MSG;
         return false;
     }
-    Record_container sorted_by_rating = lib_cat.library_title;
-    // sort the new container by rating first, then by title
-    sort(sorted_by_rating.begin(), sorted_by_rating.end(), [](const Record* a, const Record* b)
-        { return a->get_rating() == b->get_rating() ? *a < *b : a->get_rating() > b->get_rating(); });
-    ostream_iterator<Record*> out_it(cout, "\n");
-    copy(sorted_by_rating.begin(), sorted_by_rating.end(), out_it);
+    cout << cached_result("lr", Cache_generations(library_generation, 0), [&lib_cat](ostream& os)
+    {
+        // the rating groups, from the highest rating down, already hold the records in the order wanted,
+        // each group in title order, so they only need putting one after another to be formatted
+        const Library::index_type<BY_RATING>& ratings = lib_cat.library.get<BY_RATING>();
+        vector<Record*> sorted_by_rating;
+        sorted_by_rating.reserve(lib_cat.library.size());
+        for (auto group_it = ratings.end(); group_it != ratings.begin();)
+        {
+            --group_it;
+            sorted_by_rating.insert(sorted_by_rating.end(), group_it->second.begin(), group_it->second.end());
+        }
+        parallel_format(sorted_by_rating.size(), os, [&sorted_by_rating](size_t begin, size_t end, ostream& chunk_os)
+        {
+            ostream_iterator<Record*> out_it(chunk_os, "\n");
+            copy(sorted_by_rating.begin() + begin, sorted_by_rating.begin() + end, out_it);
+        });
+    });
     return false;
 }
 
 bool print_record(data_container& lib_cat)
 {
-    Record *record_ptr = *read_id_get_iter(lib_cat);
+    Record *record_ptr = read_id_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error(NO_ID_MSG);
+    }
     cout << *record_ptr << "\n";
     return false;
 }
 bool print_collection(data_container& lib_cat)
 {
-    Collection& collection = *read_name_get_iter(lib_cat);
-    cout << collection;
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    // the output shows the members' titles and ratings as well as who the members are
+    cout << cached_result("pc " + collection_ptr->get_name(), Cache_generations(collection_ptr->get_generation(), record_generation),
+        [collection_ptr](ostream& os) { os << *collection_ptr; });
     return false;
 }
 bool print_library(data_container& lib_cat)
 {
-    if (lib_cat.library_title.empty())
+    if (lib_cat.library.empty())
     {
         cout << LIBRARY_EMPTY_MSG;
     }
     else
     {
-        cout << "Library contains " << lib_cat.library_title.size() << " records:\n";
-        ostream_iterator<Record*> out_it(cout, "\n");
-        copy(lib_cat.library_title.begin(), lib_cat.library_title.end(), out_it);
+        cout << "Library contains " << lib_cat.library.size() << " records:\n";
+        const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+        parallel_format(titles.size(), cout, [&titles](size_t begin, size_t end, ostream& chunk_os)
+        {
+            ostream_iterator<Record*> out_it(chunk_os, "\n");
+            copy(titles.begin() + begin, titles.begin() + end, out_it);
+        });
     }
     return false;
 }
@@ -479,7 +1373,7 @@ bool print_catalog(data_container& lib_cat)
     else
     {
         cout << "Catalog contains " << lib_cat.catalog.size() << " collections:\n";
-        ostream_iterator<Collection> out_it(cout);
+        ostream_iterator<Collection*> out_it(cout);
         copy(lib_cat.catalog.begin(), lib_cat.catalog.end(), out_it);
     }
     return false;
@@ -487,110 +1381,200 @@ bool print_catalog(data_container& lib_cat)
 bool print_allocation(data_container& lib_cat)
 {
     cout << "Memory allocations:\n";
-    cout << "Records: " << lib_cat.library_title.size() << "\n";
+    cout << "Records: " << lib_cat.library.size() << "\n";
     cout << "Collections: " << lib_cat.catalog.size() << "\n";
+    auto print_usage = [](const char* label, const Memory_usage& usage)
+        { cout << label << ": " << usage.live_bytes << " bytes live, " << usage.peak_bytes << " bytes peak, "
+            << usage.allocations << " allocations\n"; };
+    print_usage("Tracked memory", total_memory_usage());
+    for (int category = 0; category < NUM_MEMORY_CATEGORIES; ++category)
+    {
+        Memory_category memory_category = static_cast<Memory_category>(category);
+        print_usage((string("  ") + memory_category_name(memory_category)).c_str(), memory_usage(memory_category));
+    }
+    if (Title_store* title_store = Record::get_title_store())
+    {
+        unsigned long long hits = title_store->get_hits(), lookups = hits + title_store->get_misses();
+        cout << "Title store: " << title_store->get_num_titles() << " titles, " << title_store->get_file_bytes() << " bytes on disk\n";
+        cout << "  " << title_store->get_resident_bytes() << " of " << title_store->get_budget() << " budget bytes resident, "
+            << hits << " hits out of " << lookups << " lookups (" << (lookups ? hits * 100 / lookups : 0) << "% hit rate)\n";
+    }
     return false;
 }
 
-// functor used to gather stats about the collections
-struct Collection_stats {
-public:
-    void operator()(Collection& collection)
-    {
-        // the one range for
-        for (auto& record : collection.get_elements())
-        {
-            process_record(record);
-        }
-    }
-    void process_record(Record* const record)
+bool print_heap_allocations(data_container& lib_cat)
+{
+    cout << "Previous command made " << previous_command_allocations << " heap allocations\n";
+    return false;
+}
+
+bool print_feed(data_container& lib_cat)
+{
+    if (!change_feed)
     {
-        // add key to map if it has not yet been added
-        if (record_count.find(record->get_ID()) == record_count.end())
-        {
-            record_count[record->get_ID()] = 0;
-        }
-        // find the current value of the record's ID in the map
-        int& current_count = record_count[record->get_ID()];
-        if (current_count == 0)
-        {
-            // if the current value is 0, it must be in at least one collection
-            ++at_least_one;
-        } else if (current_count == 1)
-        {
-            // if the current value is 1, it must be in more than one collection
-            ++many;
-        }
-        ++all;
-        ++current_count;
+        return report_error("No change feed!");
     }
-    int get_one() { return at_least_one; }
-    int get_many() { return many; }
-    int get_all() { return all; }
-private:
-    // maps record ID's to the number of collections in which they occur
-    map<int, int> record_count;
-    int at_least_one = 0, many = 0, all = 0;
-};
-bool collection_statistics(data_container& lib_cat)
+    cout << "Change feed: " << change_feed->get_num_commits() << " commands, " << change_feed->get_num_changes() << " changes, "
+        << change_feed->get_num_bytes() << " bytes written\n";
+    return false;
+}
+
+bool print_result_cache(data_container& lib_cat)
 {
-    Collection_stats stats_helper;
-    stats_helper = for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), stats_helper);
+    cout << "Result cache: " << result_cache.size() << " results, " << result_cache.get_bytes() << " bytes\n";
+    cout << result_cache.get_hits() << " hits, " << result_cache.get_misses() << " misses, "
+        << result_cache.get_stale() << " out of date, " << result_cache.get_evictions() << " evicted\n";
+    return false;
+}
 
-    int lib_size = lib_cat.library_title.size();
-    cout << stats_helper.get_one() << " out of " << lib_size << " Records appear in at least one Collection\n";
-    cout << stats_helper.get_many() << " out of " << lib_size << " Records appear in more than one Collection\n";
-    cout << "Collections contain a total of " << stats_helper.get_all() << " Records\n";
+bool collection_statistics(data_container& lib_cat)
+{
+    // the statistics are kept up to date by the catalog as members come and go
+    int lib_size = lib_cat.library.size();
+    cout << lib_cat.catalog.get_num_in_any() << " out of " << lib_size << " Records appear in at least one Collection\n";
+    cout << lib_cat.catalog.get_num_in_many() << " out of " << lib_size << " Records appear in more than one Collection\n";
+    cout << "Collections contain a total of " << lib_cat.catalog.get_num_memberships() << " Records\n";
     return false;
 }
 bool combine_collections(data_container& lib_cat)
 {
-    Collection first = *read_name_get_iter(lib_cat);
-    Collection second = *read_name_get_iter(lib_cat);
+    Collection *first_ptr = read_name_get_collection(lib_cat);
+    if (!first_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Collection *second_ptr = read_name_get_collection(lib_cat);
+    if (!second_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
     string new_name;
     cin >> new_name;
-    Collection result(new_name, first);
-    result += second;
+    Collection result(new_name, *first_ptr);
+    result += *second_ptr;
     insert_collection(lib_cat, move(result));
-    cout << "Collections " << first.get_name() << " and " << second.get_name() << " combined into new collection " << new_name << "\n";
+    if (change_feed)
+    {
+        Collection *combined_ptr = lib_cat.catalog.find(new_name);
+        change_feed->collection_added(new_name);
+        for_each(combined_ptr->begin(), combined_ptr->end(), [&new_name](Record* record) { change_feed->member_added(new_name, record->get_ID()); });
+    }
+    cout << "Collections " << first_ptr->get_name() << " and " << second_ptr->get_name() << " combined into new collection " << new_name << "\n";
+    return false;
+}
+// Returns the Jaccard similarity of the members of two non-empty collections: how many they have in common
+// out of how many are in either
+double collection_similarity(const Collection& first, const Collection& second)
+{
+    // both sets of members are in title order, so they are merged in one pass
+    size_t num_common = 0;
+    Less_than_ptr<Record*> before;
+    for (auto first_it = first.begin(), second_it = second.begin(); first_it != first.end() && second_it != second.end();)
+    {
+        if (before(*first_it, *second_it))
+        {
+            ++first_it;
+        } else if (before(*second_it, *first_it))
+        {
+            ++second_it;
+        } else
+        {
+            ++num_common;
+            ++first_it;
+            ++second_it;
+        }
+    }
+    return static_cast<double>(num_common) / (first.size() + second.size() - num_common);
+}
+/* Prints the collections most like a named one, by the similarity of their members estimated from their MinHash
+ * signatures, or with "exact" at the end of the line, by their exact similarity. Only the collections sharing a band
+ * of the signature with the named one are considered, which are those likely to be at all similar.
+ */
+bool find_similar_collections(data_container& lib_cat)
+{
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    int num_wanted = integer_read();
+    if (num_wanted < 1)
+    {
+        throw Error("Invalid number of collections!");
+    }
+    string line, option;
+    getline(cin, line);
+    istringstream options(line);
+    bool exact = false;
+    if (options >> option)
+    {
+        if (option != "exact" || options >> option)
+        {
+            throw ErrorNoClear("Invalid similarity option!");
+        }
+        exact = true;
+    }
+
+    vector<Collection*> candidates = lib_cat.catalog.find_similar_candidates(*collection_ptr);
+    if (candidates.empty())
+    {
+        return report_error_no_clear("No similar collections found!");
+    }
+    const Minhash_signature& signature = collection_ptr->get_signature();
+    vector<pair<double, Collection*>> ranked;
+    ranked.reserve(candidates.size());
+    for (Collection* candidate : candidates)
+    {
+        ranked.emplace_back(exact ? collection_similarity(*collection_ptr, *candidate)
+            : signature.estimate_similarity(candidate->get_signature()), candidate);
+    }
+    // the most similar first, and those equally similar in name order
+    auto more_similar = [](const pair<double, Collection*>& a, const pair<double, Collection*>& b)
+        { return a.first == b.first ? *a.second < *b.second : a.first > b.first; };
+    size_t num_shown = min(ranked.size(), static_cast<size_t>(num_wanted));
+    partial_sort(ranked.begin(), ranked.begin() + num_shown, ranked.end(), more_similar);
+    cout << "Collections similar to " << collection_ptr->get_name() << (exact ? " (exact):\n" : " (estimated):\n");
+    for_each(ranked.begin(), ranked.begin() + num_shown, [](const pair<double, Collection*>& similar)
+        { cout << similar.second->get_name() << " " << static_cast<int>(similar.first * 100 + 0.5) << "%\n"; });
     return false;
 }
 
 bool modify_rating(data_container& lib_cat)
 {
-    Record *record_ptr = *read_id_get_iter(lib_cat);
+    Record *record_ptr = read_id_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error(NO_ID_MSG);
+    }
     int rating = integer_read();
-    record_ptr->set_rating(rating);
+    change_rating(lib_cat, record_ptr, rating);
+    if (change_feed)
+    {
+        change_feed->rating_modified(record_ptr->get_ID(), rating);
+    }
     cout << "Rating for record " << record_ptr->get_ID() << " changed to " << rating << "\n";
     return false;
 }
 bool modify_title(data_container& lib_cat)
 {
-    auto record_iter = read_id_get_iter(lib_cat);
-    Record *record_ptr = *record_iter;
+    Record *record_ptr = read_id_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error(NO_ID_MSG);
+    }
 
     // make sure the new title is not already in the library
     string title = title_read(cin);
-    check_title_in_library(lib_cat, title);
-
-    // remove the record from all collections and remember what collections it is in
-    list<Collection*> collections_with_record;
-    for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), [&collections_with_record, record_ptr](Collection& collection)
-        { if (collection.is_member_present(record_ptr)) { collection.remove_member(record_ptr); collections_with_record.push_back(&collection); }});
-
-    // remove the record from the library
-    lib_cat.library_id.erase(record_iter);
-    assert(binary_search(lib_cat.library_title.begin(), lib_cat.library_title.end(), record_ptr, Title_compare()));
-    lib_cat.library_title.erase(lib_title_lower_bound(lib_cat, record_ptr));
-
-    // change the record's title and add it back into the library
-    string old_title = record_ptr->get_title();
-    record_ptr->set_title(title);
-    insert_record(lib_cat, record_ptr);
-
-    // add the record back into all the collections it was in
-    for_each(collections_with_record.begin(), collections_with_record.end(), [record_ptr](Collection* collection) { collection->add_member(record_ptr); });
+    if (find_title(lib_cat, title))
+    {
+        return report_error_no_clear(DUPLICATE_TITLE_MSG);
+    }
 
+    change_title(lib_cat, record_ptr, title);
+    if (change_feed)
+    {
+        change_feed->title_modified(record_ptr->get_ID(), title);
+    }
     cout << "Title for record " << record_ptr->get_ID() << " changed to " << title << "\n";
     return false;
 }
@@ -600,83 +1584,350 @@ bool add_record(data_container& lib_cat)
     string medium, title;
     cin >> medium;
     title = title_read(cin);
-    check_title_in_library(lib_cat, title);
+    if (find_title(lib_cat, title))
+    {
+        return report_error_no_clear(DUPLICATE_TITLE_MSG);
+    }
     Record *record = insert_record(lib_cat, new Record(medium, title));
+    if (change_feed)
+    {
+        change_feed->record_added(record->get_ID(), 0, medium, title);
+    }
     cout << "Record " << record->get_ID() << " added\n";
     return false;
 }
+// Merges a batch of parsed records into the library. The records that are kept are given consecutive
+// ID numbers in input order; invalid lines and titles already in the library or earlier in the batch are skipped.
+void merge_parsed_batch(data_container& lib_cat, Parsed_batch& batch, int& num_imported, int& num_skipped)
+{
+    vector<Parsed_record*> accepted;
+    unordered_set<string> batch_titles;
+    for (auto& parsed : batch)
+    {
+        if (parsed.title.empty() || find_title(lib_cat, parsed.title) || !batch_titles.insert(parsed.title).second)
+        {
+            ++num_skipped;
+        } else
+        {
+            accepted.push_back(&parsed);
+        }
+    }
+    if (accepted.empty())
+    {
+        return;
+    }
+    int first_ID = Record::reserve_IDs(accepted.size());
+    Record_container records;
+    try
+    {
+        records.reserve(accepted.size());
+        for (size_t i = 0; i < accepted.size(); ++i)
+        {
+            records.push_back(new Record(first_ID + i, accepted[i]->medium, accepted[i]->title));
+        }
+    } catch (...)
+    {
+        for_each(records.begin(), records.end(), [](Record* record) { delete record; });
+        throw;
+    }
+    insert_records(lib_cat, records);
+    if (change_feed)
+    {
+        for_each(records.begin(), records.end(), [](Record* record)
+            { change_feed->record_added(record->get_ID(), 0, record->get_medium(), record->get_title()); });
+    }
+    num_imported += accepted.size();
+}
+bool import_records(data_container& lib_cat)
+{
+    string filename;
+    cin >> filename;
+    ifstream file(filename.c_str());
+    if (!file)
+    {
+        throw Error(FILE_OPEN_FAIL_MSG);
+    }
+    int num_imported = 0, num_skipped = 0;
+    ingest_records(file, num_scan_threads, [&lib_cat, &num_imported, &num_skipped](Parsed_batch& batch)
+        { merge_parsed_batch(lib_cat, batch, num_imported, num_skipped); });
+    cout << num_imported << " records imported, " << num_skipped << " lines skipped\n";
+    return false;
+}
 bool add_collection(data_container& lib_cat)
 {
     string name;
     cin >> name;
     insert_collection(lib_cat, Collection(name));
+    if (change_feed)
+    {
+        change_feed->collection_added(name);
+    }
     cout << "Collection " << name << " added\n";
     return false;
 }
-bool add_member(data_container& lib_cat)
+// the records picked out for a batch of members: those with the listed IDs, with IDs in a range, or with titles
+// starting with a prefix
+struct Member_filter
 {
-    Collection& collection = *read_name_get_iter(lib_cat);
-    Record *record_ptr = *read_id_get_iter(lib_cat);
-    collection.add_member(record_ptr);
-    cout << "Member " << record_ptr->get_ID() << " " << record_ptr->get_title() << " added\n";
-    return false;
-}
-
-bool delete_record(data_container& lib_cat)
+    enum Kind { ID_LIST, ID_RANGE, TITLE_PREFIX } kind = ID_LIST;
+    vector<int> IDs;
+    int id_min = 0, id_max = 0;
+    string prefix;
+};
+/* Reads a member filter from the rest of the line, one of:
+ *   ids <ID> <ID> ..., range <min ID> <max ID>, or prefix <title prefix>
+ */
+Member_filter member_filter_read()
 {
-    auto record_iter = read_title_get_iter(lib_cat);
-    if (find_if(lib_cat.catalog.begin(), lib_cat.catalog.end(), bind(&Collection::is_member_present, placeholders::_1, *record_iter)) != lib_cat.catalog.end())
+    string line, kind;
+    getline(cin, line);
+    istringstream filter_line(line);
+    Member_filter filter;
+    filter_line >> kind;
+    if (kind == "ids")
     {
-        throw ErrorNoClear("Cannot delete a record that is a member of a collection!");
+        int ID;
+        while (filter_line >> ID)
+        {
+            filter.IDs.push_back(ID);
+        }
+        if (filter.IDs.empty() || !filter_line.eof())
+        {
+            throw ErrorNoClear(INVALID_FILTER_MSG);
+        }
+    } else if (kind == "range")
+    {
+        filter.kind = Member_filter::ID_RANGE;
+        string rest;
+        if (!(filter_line >> filter.id_min >> filter.id_max) || filter.id_min > filter.id_max || filter_line >> rest)
+        {
+            throw ErrorNoClear(INVALID_FILTER_MSG);
+        }
+    } else if (kind == "prefix")
+    {
+        filter.kind = Member_filter::TITLE_PREFIX;
+        string raw_prefix;
+        getline(filter_line, raw_prefix);
+        filter.prefix = parse_title(raw_prefix);
+        if (filter.prefix.empty())
+        {
+            throw ErrorNoClear(INVALID_FILTER_MSG);
+        }
+    } else
+    {
+        throw ErrorNoClear(INVALID_FILTER_MSG);
     }
-    Record *record_ptr = *record_iter;
-    lib_cat.library_title.erase(record_iter);
-    assert(binary_search(lib_cat.library_id.begin(), lib_cat.library_id.end(), record_ptr, ID_compare()));
-    lib_cat.library_id.erase(lib_id_lower_bound(lib_cat, record_ptr));
-    cout << "Record " << record_ptr->get_ID() << " " << record_ptr->get_title() << " deleted\n";
-    delete record_ptr;
-    return false;
+    return filter;
 }
-bool delete_collection(data_container& lib_cat)
+// Returns the records in the library that a filter picks out, in title order and once for each time the filter
+// names them, and counts the IDs it names that no record has
+Record_container member_filter_records(data_container& lib_cat, const Member_filter& filter, long long& num_missing)
 {
-    auto collection_iter = read_name_get_iter(lib_cat);
-    Collection& collection = *collection_iter;
-    string name = collection.get_name();
-    lib_cat.catalog.erase(collection_iter);
-    cout << "Collection " << name << " deleted\n";
-    return false;
-}
+    Record_container records;
+    num_missing = 0;
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    auto add_ID = [&lib_cat, &records, &num_missing](int ID)
+    {
+        if (Record *record_ptr = lib_cat.library.get<BY_ID>().find(ID))
+        {
+            records.push_back(record_ptr);
+        } else
+        {
+            ++num_missing;
+        }
+    };
+    switch (filter.kind)
+    {
+        case Member_filter::ID_LIST:
+            for_each(filter.IDs.begin(), filter.IDs.end(), add_ID);
+            sort(records.begin(), records.end(), Title_compare());
+            break;
+        case Member_filter::ID_RANGE:
+        {
+            long long range_size = static_cast<long long>(filter.id_max) - filter.id_min + 1;
+            // a range wider than the library is looked for in the library rather than ID by ID
+            if (range_size > static_cast<long long>(titles.size()))
+            {
+                copy_if(titles.begin(), titles.end(), back_inserter(records), [&filter](Record* record)
+                    { return record->get_ID() >= filter.id_min && record->get_ID() <= filter.id_max; });
+                num_missing = range_size - records.size();
+                break;
+            }
+            for (long long ID = filter.id_min; ID <= filter.id_max; ++ID)
+            {
+                add_ID(static_cast<int>(ID));
+            }
+            sort(records.begin(), records.end(), Title_compare());
+            break;
+        }
+        case Member_filter::TITLE_PREFIX:
+        {
+            const string& prefix = filter.prefix;
+            auto prefix_begin = lower_bound(titles.begin(), titles.end(), prefix,
+                [](Record* r, const string& p) { return r->compare_title(0, string::npos, p) < 0; });
+            auto prefix_end = upper_bound(prefix_begin, titles.end(), prefix,
+                [](const string& p, Record* r) { return r->compare_title(0, p.size(), p) > 0; });
+            records.assign(prefix_begin, prefix_end);
+            break;
+        }
+    }
+    return records;
+}
+
+bool add_member(data_container& lib_cat)
+{
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Record *record_ptr = read_id_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    lib_cat.catalog.add_member(*collection_ptr, record_ptr);
+    if (change_feed)
+    {
+        change_feed->member_added(collection_ptr->get_name(), record_ptr->get_ID());
+    }
+    cout << "Member " << record_ptr->get_ID() << " " << record_ptr->get_title() << " added\n";
+    return false;
+}
+// Adds the records a member filter picks out to a collection, and prints how many were added,
+// how many were members already, and how many IDs no record has
+bool add_members(data_container& lib_cat)
+{
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Member_filter filter = member_filter_read();
+    long long num_missing;
+    Record_container records = member_filter_records(lib_cat, filter, num_missing);
+    vector<Record*> added = lib_cat.catalog.add_members(*collection_ptr, records);
+    if (change_feed)
+    {
+        for_each(added.begin(), added.end(), [collection_ptr](Record* record)
+            { change_feed->member_added(collection_ptr->get_name(), record->get_ID()); });
+    }
+    cout << "Members added to " << collection_ptr->get_name() << ": " << added.size() << " added, "
+        << records.size() - added.size() << " already present, " << num_missing << " missing\n";
+    return false;
+}
+
+bool delete_record(data_container& lib_cat)
+{
+    Record *record_ptr = read_title_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error_no_clear(NO_TITLE_MSG);
+    }
+    if (record_ptr->get_membership_count() > 0)
+    {
+        throw ErrorNoClear("Cannot delete a record that is a member of a collection!");
+    }
+    remove_record(lib_cat, record_ptr);
+    if (change_feed)
+    {
+        change_feed->record_deleted(record_ptr->get_ID());
+    }
+    cout << "Record " << record_ptr->get_ID() << " " << record_ptr->get_title() << " deleted\n";
+    delete record_ptr;
+    return false;
+}
+bool delete_collection(data_container& lib_cat)
+{
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    string name = collection_ptr->get_name();
+    lib_cat.catalog.erase(name);
+    if (change_feed)
+    {
+        change_feed->collection_deleted(name);
+    }
+    cout << "Collection " << name << " deleted\n";
+    return false;
+}
 bool delete_member(data_container& lib_cat)
 {
-    Collection& collection = *read_name_get_iter(lib_cat);
-    Record *record_ptr = *read_id_get_iter(lib_cat);
-    collection.remove_member(record_ptr);
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Record *record_ptr = read_id_get_record(lib_cat);
+    if (!record_ptr)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    lib_cat.catalog.remove_member(*collection_ptr, record_ptr);
+    if (change_feed)
+    {
+        change_feed->member_deleted(collection_ptr->get_name(), record_ptr->get_ID());
+    }
     cout << "Member " << record_ptr->get_ID() << " " << record_ptr->get_title() << " deleted\n";
     return false;
 }
+// Deletes the records a member filter picks out from a collection, and prints how many were deleted,
+// how many were not members, and how many IDs no record has
+bool delete_members(data_container& lib_cat)
+{
+    Collection *collection_ptr = read_name_get_collection(lib_cat);
+    if (!collection_ptr)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Member_filter filter = member_filter_read();
+    long long num_missing;
+    Record_container records = member_filter_records(lib_cat, filter, num_missing);
+    vector<Record*> removed = lib_cat.catalog.remove_members(*collection_ptr, records);
+    if (change_feed)
+    {
+        for_each(removed.begin(), removed.end(), [collection_ptr](Record* record)
+            { change_feed->member_deleted(collection_ptr->get_name(), record->get_ID()); });
+    }
+    cout << "Members deleted from " << collection_ptr->get_name() << ": " << removed.size() << " deleted, "
+        << records.size() - removed.size() << " not present, " << num_missing << " missing\n";
+    return false;
+}
 
 bool clear_library(data_container& lib_cat)
 {
-    if (find_if(lib_cat.catalog.begin(), lib_cat.catalog.end(), [](Collection c){return !c.empty();}) != lib_cat.catalog.end())
+    if (lib_cat.catalog.get_num_memberships() > 0)
     {
         throw Error("Cannot clear all records unless all collections are empty!");
     }
     Record::reset_ID_counter();
     clear_library_data(lib_cat);
+    if (change_feed)
+    {
+        change_feed->library_cleared();
+    }
     cout << "All records deleted\n";
     return false;
 }
 bool clear_catalog(data_container& lib_cat)
 {
     lib_cat.catalog.clear();
+    if (change_feed)
+    {
+        change_feed->catalog_cleared();
+    }
     cout << "All collections deleted\n";
     return false;
 }
 bool clear_all(data_container& lib_cat)
 {
-    Record::reset_ID_counter();
-    clear_library_data(lib_cat);
-    lib_cat.catalog.clear();
+    clear_all_data(lib_cat);
+    if (change_feed)
+    {
+        change_feed->all_cleared();
+    }
     cout << "All data deleted\n";
     return false;
 }
@@ -690,18 +1941,270 @@ bool save_all(data_container& lib_cat)
     {
         throw Error(FILE_OPEN_FAIL_MSG);
     }
-    file << lib_cat.library_title.size() << "\n";
-    for_each(lib_cat.library_title.begin(), lib_cat.library_title.end(), bind(&Record::save, placeholders::_1, ref(file)));
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    file << titles.size() << "\n";
+    {
+        TRACE_SPAN("save_records");
+        for_each(titles.begin(), titles.end(), bind(&Record::save, placeholders::_1, ref(file)));
+    }
     file << lib_cat.catalog.size() << "\n";
-    for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), bind(&Collection::save, placeholders::_1, ref(file)));
+    for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), [&file](Collection* collection)
+    {
+        TRACE_SPAN("save_collection", collection->get_name());
+        collection->save(file);
+    });
+    file.close();
+    // mark where in the feed the library was saved, so that a replica can start from the file
+    if (change_feed)
+    {
+        change_feed->snapshot_saved(file_checksum(filename));
+    }
     cout << "Data saved\n";
     return false;
 }
+// Writes the library and catalog to a file in columnar form for analytics, a group of rows at a time
+bool export_all(data_container& lib_cat)
+{
+    string filename;
+    cin >> filename;
+    Columnar_writer writer(filename);
+    const Title_index& titles = lib_cat.library.get<BY_TITLE>();
+    for_each(titles.begin(), titles.end(), [&writer](Record* record) { writer.add_record(*record); });
+    for_each(lib_cat.catalog.begin(), lib_cat.catalog.end(), [&writer](Collection* collection)
+    {
+        writer.add_collection(collection->get_name(), collection->size());
+        for_each(collection->begin(), collection->end(), [&writer](Record* record) { writer.add_member(record->get_ID()); });
+    });
+    writer.finish();
+    cout << "Exported " << writer.get_num_records() << " records, " << writer.get_num_collections() << " collections and "
+        << writer.get_num_memberships() << " memberships\n";
+    return false;
+}
+// Saves the trace spans recorded so far to a file; this works the same for any kind of library
+template<typename Container>
+bool save_trace(Container&)
+{
+    string filename;
+    cin >> filename;
+    if (!TRACE_COMPILED_IN)
+    {
+        throw Error("Tracing is not compiled in!");
+    }
+    ofstream file(filename.c_str());
+    if (!file)
+    {
+        throw Error(FILE_OPEN_FAIL_MSG);
+    }
+    size_t num_spans = write_trace(file);
+    cout << "Trace of " << num_spans << " spans saved\n";
+    return false;
+}
 
 bool restore_all(data_container& lib_cat)
 {
     string filename;
     cin >> filename;
+    restore_data(lib_cat, filename);
+    if (change_feed)
+    {
+        change_feed->all_cleared();
+        feed_all_data(lib_cat);
+    }
+    cout << "Data loaded\n";
+    return false;
+}
+
+bool quit(data_container& lib_cat)
+{
+    // replicas keep the library as it was when the primary quit, so this is not sent to the feed
+    clear_all_data(lib_cat);
+    cout << "All data deleted\n";
+    cout << "Done\n";
+    return true;
+}
+bool add_record_with_ID(data_container& lib_cat)
+{
+    int ID = integer_read();
+    string medium;
+    cin >> medium;
+    string title = title_read(cin);
+    if (find_title(lib_cat, title))
+    {
+        return report_error_no_clear(DUPLICATE_TITLE_MSG);
+    }
+    Record *record = insert_record(lib_cat, new Record(ID, medium, title));
+    cout << "Record " << record->get_ID() << " added\n";
+    return false;
+}
+
+/* partitioned lib cat functions impl */
+
+// Prints a worker's reply as the reply to the current command, clearing the rest of the line after an error
+bool forward_reply(const Worker_reply& reply)
+{
+    cout << reply.output;
+    command_result = reply.result;
+    if (reply.result == Result_class::ERROR)
+    {
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    return false;
+}
+// Returns the record lines in a worker's output, after skipping the given number of lines
+vector<Record_line> reply_record_lines(const string& output, size_t skip)
+{
+    vector<string> lines = split_lines(output);
+    vector<Record_line> record_lines;
+    for (size_t i = skip; i < lines.size(); ++i)
+    {
+        record_lines.push_back(parse_record_line(lines[i]));
+    }
+    return record_lines;
+}
+// Returns the record lines for the given IDs, fetched from their shards all at once
+map<int, Record_line> fetch_record_lines(partition_container& partition, const vector<int>& IDs)
+{
+    vector<vector<string>> commands(partition.shards.size());
+    vector<vector<int>> requested_IDs(partition.shards.size());
+    for (int ID : IDs)
+    {
+        int shard = partition.ID_shards.at(ID);
+        commands[shard].push_back("pr " + to_string(ID));
+        requested_IDs[shard].push_back(ID);
+    }
+    vector<vector<Worker_reply>> replies = partition.shards.exchange(commands);
+    map<int, Record_line> record_lines;
+    for (size_t shard = 0; shard < replies.size(); ++shard)
+    {
+        for (size_t i = 0; i < replies[shard].size(); ++i)
+        {
+            record_lines[requested_IDs[shard][i]] = reply_record_lines(replies[shard][i].output, 0).at(0);
+        }
+    }
+    return record_lines;
+}
+// Prints a collection as Collection's output operator does, with the given record lines
+void print_partition_collection(const string& name, const Partition_members& members, map<int, Record_line>& record_lines)
+{
+    cout << "Collection " << name << " contains:";
+    if (members.empty())
+    {
+        cout << " None\n";
+        return;
+    }
+    cout << "\n";
+    vector<pair<string, int>> members_by_title;
+    for_each(members.begin(), members.end(), [&members_by_title](const Partition_members::value_type& member)
+        { members_by_title.push_back(make_pair(member.second, member.first)); });
+    sort(members_by_title.begin(), members_by_title.end());
+    for_each(members_by_title.begin(), members_by_title.end(), [&record_lines](const pair<string, int>& member)
+        { cout << record_lines[member.second].text << "\n"; });
+}
+// Read a name from stdin and then return a pointer to the members of the collection with that name, or nullptr
+Partition_members* read_name_get_partition_members(partition_container& partition)
+{
+    string name;
+    cin >> name;
+    auto collection_iter = partition.catalog.find(name);
+    return collection_iter == partition.catalog.end() ? nullptr : &collection_iter->second;
+}
+// Read an id from stdin and then return it if a shard has a record with that id, or 0
+int read_id_get_partition_ID(partition_container& partition)
+{
+    int ID = integer_read();
+    return partition.ID_shards.count(ID) ? ID : 0;
+}
+// Returns the IDs of the records a member filter picks out, in order and once for each time the filter names them,
+// and counts the IDs it names that no record has
+vector<int> partition_filter_IDs(partition_container& partition, const Member_filter& filter, long long& num_missing)
+{
+    vector<int> IDs;
+    num_missing = 0;
+    switch (filter.kind)
+    {
+        case Member_filter::ID_LIST:
+            copy_if(filter.IDs.begin(), filter.IDs.end(), back_inserter(IDs), [&partition](int ID) { return partition.ID_shards.count(ID) > 0; });
+            num_missing = filter.IDs.size() - IDs.size();
+            break;
+        case Member_filter::ID_RANGE:
+        {
+            long long range_size = static_cast<long long>(filter.id_max) - filter.id_min + 1;
+            if (range_size > static_cast<long long>(partition.ID_shards.size()))
+            {
+                for_each(partition.ID_shards.begin(), partition.ID_shards.end(), [&filter, &IDs](const pair<const int, int>& ID_shard)
+                    { if (ID_shard.first >= filter.id_min && ID_shard.first <= filter.id_max) { IDs.push_back(ID_shard.first); } });
+            } else
+            {
+                for (long long ID = filter.id_min; ID <= filter.id_max; ++ID)
+                {
+                    if (partition.ID_shards.count(static_cast<int>(ID)))
+                    {
+                        IDs.push_back(static_cast<int>(ID));
+                    }
+                }
+            }
+            num_missing = range_size - IDs.size();
+            break;
+        }
+        case Member_filter::TITLE_PREFIX:
+        {
+            // the titles sharing a prefix are one range of titles, which may span several shards
+            pair<int, int> prefix_shards = partition.shards.shards_for_prefix(filter.prefix);
+            vector<vector<string>> commands(partition.shards.size());
+            for (int shard = prefix_shards.first; shard <= prefix_shards.second; ++shard)
+            {
+                commands[shard].push_back("fq prefix " + filter.prefix);
+            }
+            vector<vector<Worker_reply>> replies = partition.shards.exchange(commands);
+            for (int shard = prefix_shards.first; shard <= prefix_shards.second; ++shard)
+            {
+                const Worker_reply& found = replies[shard].front();
+                if (found.result == Result_class::OK)
+                {
+                    vector<Record_line> lines = reply_record_lines(found.output, 0);
+                    transform(lines.begin(), lines.end(), back_inserter(IDs), [](const Record_line& line) { return line.ID; });
+                }
+            }
+            break;
+        }
+    }
+    sort(IDs.begin(), IDs.end());
+    return IDs;
+}
+// Update the count of collections the record with an ID is a member of
+void count_partition_member(partition_container& partition, int ID)
+{
+    ++partition.membership_counts[ID];
+}
+void uncount_partition_member(partition_container& partition, int ID)
+{
+    auto count_iter = partition.membership_counts.find(ID);
+    if (--count_iter->second == 0)
+    {
+        partition.membership_counts.erase(count_iter);
+    }
+}
+// Returns the record lines of the whole library in title order, gathered from all the shards
+vector<Record_line> partition_library_lines(partition_container& partition)
+{
+    if (partition.ID_shards.empty())
+    {
+        return vector<Record_line>();
+    }
+    vector<Worker_reply> replies = partition.shards.ask_all("pL");
+    vector<vector<Record_line>> shard_lines;
+    for (auto& reply : replies)
+    {
+        // skip the line giving the shard's own count
+        shard_lines.push_back(reply.output == LIBRARY_EMPTY_MSG ? vector<Record_line>() : reply_record_lines(reply.output, 1));
+    }
+    return merge_record_lines(shard_lines, [](const Record_line& a, const Record_line& b) { return a.title < b.title; });
+}
+// Replaces the library and catalog with those saved in a file, choosing the shard ranges again for the saved titles.
+// Throw Error exception if the file is invalid, before any shard is changed.
+void restore_partition_data(partition_container& partition, const string& filename)
+{
     ifstream file(filename.c_str());
     if (!file)
     {
@@ -712,43 +2215,714 @@ bool restore_all(data_container& lib_cat)
     {
         throw Error(FILE_ERROR_MSG);
     }
-    data_container new_lib_cat;
-    try
+    vector<Record_line> records;
+    map<string, int> title_IDs;
+    unordered_set<int> IDs;
+    for (int i = 0; i < num_records; i++)
     {
-        Record::save_ID_counter();
-        Record::reset_ID_counter();
-        for (int i = 0; i < num_records; i++)
+        Record_line record;
+        if (!(file >> record.ID >> record.medium >> record.rating) || !file.get())
         {
-            insert_record(new_lib_cat, new Record(file));
+            throw Error(FILE_ERROR_MSG);
         }
-        int num_collections;
-        if (!(file >> num_collections))
+        getline(file, record.title);
+        if (!title_IDs.insert(make_pair(record.title, record.ID)).second || !IDs.insert(record.ID).second)
         {
             throw Error(FILE_ERROR_MSG);
+        }
+        records.push_back(move(record));
+    }
+    int num_collections;
+    if (!(file >> num_collections))
+    {
+        throw Error(FILE_ERROR_MSG);
+    }
+    map<string, Partition_members> catalog;
+    for (int i = 0; i < num_collections; i++)
+    {
+        string name;
+        int num;
+        if (!(file >> name >> num))
+        {
+            throw Error(FILE_ERROR_MSG);
+        }
+        file.ignore(numeric_limits<streamsize>::max(), '\n');
+        Partition_members& members = catalog[name];
+        for (int j = 0; j < num; j++)
+        {
+            string title;
+            getline(file, title);
+            auto title_iter = title_IDs.find(title);
+            if (title_iter == title_IDs.end())
+            {
+                throw Error(FILE_ERROR_MSG);
+            }
+            members[title_iter->second] = title;
+        }
+    }
 
+    // the file is good, so the shards are emptied and given ranges that suit the saved titles
+    partition.shards.ask_all("cA");
+    vector<string> titles;
+    transform(records.begin(), records.end(), back_inserter(titles), [](const Record_line& record) { return record.title; });
+    partition.shards.rebalance(titles);
+    vector<vector<string>> commands(partition.shards.size());
+    partition.ID_shards.clear();
+    partition.last_ID = 0;
+    for (auto& record : records)
+    {
+        int shard = partition.shards.shard_for_title(record.title);
+        commands[shard].push_back("xa " + to_string(record.ID) + " " + record.medium + " " + record.title);
+        if (record.rating != 0)
+        {
+            commands[shard].push_back("mr " + to_string(record.ID) + " " + to_string(record.rating));
         }
-        for (int i = 0; i < num_collections; i++)
+        partition.ID_shards[record.ID] = shard;
+        partition.last_ID = max(partition.last_ID, record.ID);
+    }
+    partition.shards.exchange(commands);
+    partition.catalog = move(catalog);
+    partition.membership_counts.clear();
+    for_each(partition.catalog.begin(), partition.catalog.end(), [&partition](const pair<const string, Partition_members>& collection)
+    {
+        for_each(collection.second.begin(), collection.second.end(), [&partition](const Partition_members::value_type& member)
+            { count_partition_member(partition, member.first); });
+    });
+}
+
+bool partition_find_record(partition_container& partition)
+{
+    string title = title_read(cin);
+    return forward_reply(partition.shards.ask(partition.shards.shard_for_title(title), "fr " + title));
+}
+bool partition_find_string(partition_container& partition)
+{
+    string key;
+    cin >> key;
+    vector<Worker_reply> replies = partition.shards.ask_all("fs " + key);
+    vector<vector<Record_line>> shard_lines;
+    for (auto& reply : replies)
+    {
+        shard_lines.push_back(reply.result == Result_class::OK ? reply_record_lines(reply.output, 0) : vector<Record_line>());
+    }
+    vector<Record_line> matches = merge_record_lines(shard_lines,
+        [](const Record_line& a, const Record_line& b) { return a.title < b.title; });
+    if (matches.empty())
+    {
+        return report_error("No records contain that string!");
+    }
+    for_each(matches.begin(), matches.end(), [](const Record_line& line) { cout << line.text << "\n"; });
+    return false;
+}
+bool partition_list_ratings(partition_container& partition)
+{
+    if (partition.ID_shards.empty())
+    {
+        cout << LIBRARY_EMPTY_MSG;
+        return false;
+    }
+    vector<Worker_reply> replies = partition.shards.ask_all("lr");
+    vector<vector<Record_line>> shard_lines;
+    for (auto& reply : replies)
+    {
+        shard_lines.push_back(reply.output == LIBRARY_EMPTY_MSG ? vector<Record_line>() : reply_record_lines(reply.output, 0));
+    }
+    // rating first, then title, as list_ratings sorts them
+    vector<Record_line> by_rating = merge_record_lines(shard_lines, [](const Record_line& a, const Record_line& b)
+        { return a.rating == b.rating ? a.title < b.title : a.rating > b.rating; });
+    for_each(by_rating.begin(), by_rating.end(), [](const Record_line& line) { cout << line.text << "\n"; });
+    return false;
+}
+bool partition_print_record(partition_container& partition)
+{
+    int ID = read_id_get_partition_ID(partition);
+    if (!ID)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    return forward_reply(partition.shards.ask(partition.ID_shards[ID], "pr " + to_string(ID)));
+}
+bool partition_print_collection(partition_container& partition)
+{
+    string name;
+    cin >> name;
+    auto collection_iter = partition.catalog.find(name);
+    if (collection_iter == partition.catalog.end())
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    vector<int> IDs;
+    for_each(collection_iter->second.begin(), collection_iter->second.end(), [&IDs](const Partition_members::value_type& member)
+        { IDs.push_back(member.first); });
+    map<int, Record_line> record_lines = fetch_record_lines(partition, IDs);
+    print_partition_collection(name, collection_iter->second, record_lines);
+    return false;
+}
+bool partition_print_library(partition_container& partition)
+{
+    if (partition.ID_shards.empty())
+    {
+        cout << LIBRARY_EMPTY_MSG;
+        return false;
+    }
+    vector<Record_line> library = partition_library_lines(partition);
+    cout << "Library contains " << library.size() << " records:\n";
+    for_each(library.begin(), library.end(), [](const Record_line& line) { cout << line.text << "\n"; });
+    return false;
+}
+bool partition_print_catalog(partition_container& partition)
+{
+    if (partition.catalog.empty())
+    {
+        cout << "Catalog is empty\n";
+        return false;
+    }
+    vector<int> IDs;
+    for_each(partition.membership_counts.begin(), partition.membership_counts.end(),
+        [&IDs](const pair<const int, int>& count) { IDs.push_back(count.first); });
+    map<int, Record_line> record_lines = fetch_record_lines(partition, IDs);
+    cout << "Catalog contains " << partition.catalog.size() << " collections:\n";
+    for_each(partition.catalog.begin(), partition.catalog.end(), [&record_lines](const pair<const string, Partition_members>& collection)
+        { print_partition_collection(collection.first, collection.second, record_lines); });
+    return false;
+}
+bool partition_print_allocation(partition_container& partition)
+{
+    // each shard reports on its own process, and the records and memory are added up over all of them
+    vector<Worker_reply> replies = partition.shards.ask_all("pa");
+    int num_records = 0;
+    vector<pair<string, Memory_usage>> usages;
+    for (auto& reply : replies)
+    {
+        vector<string> lines = split_lines(reply.output);
+        size_t usage_index = 0;
+        for (auto& line : lines)
         {
-            insert_collection(new_lib_cat, Collection(file, new_lib_cat.library_title));
+            size_t colon = line.find(": ");
+            if (colon == string::npos)
+            {
+                continue;
+            }
+            istringstream values(line.substr(colon + 2));
+            if (line.compare(0, colon, "Records") == 0)
+            {
+                int shard_records = 0;
+                values >> shard_records;
+                num_records += shard_records;
+            } else if (line.find(" bytes live, ", colon) != string::npos)
+            {
+                // in the form L bytes live, P bytes peak, A allocations
+                Memory_usage usage;
+                string word;
+                values >> usage.live_bytes >> word >> word >> usage.peak_bytes >> word >> word >> usage.allocations;
+                if (usage_index == usages.size())
+                {
+                    usages.push_back(make_pair(line.substr(0, colon), Memory_usage()));
+                }
+                usages[usage_index].second.live_bytes += usage.live_bytes;
+                usages[usage_index].second.peak_bytes += usage.peak_bytes;
+                usages[usage_index].second.allocations += usage.allocations;
+                ++usage_index;
+            }
         }
-        lib_cat.catalog.clear();
-        clear_library_data(lib_cat);
-        lib_cat = new_lib_cat;
-        cout << "Data loaded\n";
     }
-    catch (Error& e)
+    cout << "Memory allocations:\n";
+    cout << "Records: " << num_records << "\n";
+    cout << "Collections: " << partition.catalog.size() << "\n";
+    for_each(usages.begin(), usages.end(), [](const pair<string, Memory_usage>& usage)
+        { cout << usage.first << ": " << usage.second.live_bytes << " bytes live, " << usage.second.peak_bytes << " bytes peak, "
+            << usage.second.allocations << " allocations\n"; });
+    return false;
+}
+bool partition_collection_statistics(partition_container& partition)
+{
+    int lib_size = partition.ID_shards.size();
+    int num_in_many = 0, num_memberships = 0;
+    for_each(partition.membership_counts.begin(), partition.membership_counts.end(), [&num_in_many, &num_memberships](const pair<const int, int>& count)
+        { num_in_many += count.second > 1; num_memberships += count.second; });
+    cout << partition.membership_counts.size() << " out of " << lib_size << " Records appear in at least one Collection\n";
+    cout << num_in_many << " out of " << lib_size << " Records appear in more than one Collection\n";
+    cout << "Collections contain a total of " << num_memberships << " Records\n";
+    return false;
+}
+bool partition_combine_collections(partition_container& partition)
+{
+    string first_name, second_name, new_name;
+    cin >> first_name;
+    auto first_iter = partition.catalog.find(first_name);
+    if (first_iter == partition.catalog.end())
     {
-        new_lib_cat.catalog.clear();
-        clear_library_data(new_lib_cat);
-        Record::restore_ID_counter();
-        throw Error(FILE_ERROR_MSG);
+        return report_error(NO_NAME_MSG);
+    }
+    cin >> second_name;
+    auto second_iter = partition.catalog.find(second_name);
+    if (second_iter == partition.catalog.end())
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    cin >> new_name;
+    if (partition.catalog.count(new_name))
+    {
+        throw Error("Catalog already has a collection with this name!");
     }
+    Partition_members combined = first_iter->second;
+    combined.insert(second_iter->second.begin(), second_iter->second.end());
+    for_each(combined.begin(), combined.end(), [&partition](const Partition_members::value_type& member)
+        { count_partition_member(partition, member.first); });
+    partition.catalog[new_name] = move(combined);
+    cout << "Collections " << first_name << " and " << second_name << " combined into new collection " << new_name << "\n";
     return false;
 }
-
-bool quit(data_container& lib_cat)
+bool partition_modify_rating(partition_container& partition)
+{
+    int ID = read_id_get_partition_ID(partition);
+    if (!ID)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    int rating = integer_read();
+    return forward_reply(partition.shards.ask(partition.ID_shards[ID], "mr " + to_string(ID) + " " + to_string(rating)));
+}
+bool partition_modify_title(partition_container& partition)
+{
+    int ID = read_id_get_partition_ID(partition);
+    if (!ID)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    string title = title_read(cin);
+    int old_shard = partition.ID_shards[ID], new_shard = partition.shards.shard_for_title(title);
+    if (partition.shards.ask(new_shard, "fr " + title).result == Result_class::OK)
+    {
+        return report_error_no_clear(DUPLICATE_TITLE_MSG);
+    }
+    if (old_shard == new_shard)
+    {
+        forward_reply(partition.shards.ask(old_shard, "mt " + to_string(ID) + " " + title));
+    } else
+    {
+        // the record moves to the shard for its new title, keeping its ID, medium and rating
+        Record_line old_record = fetch_record_lines(partition, vector<int>(1, ID)).at(ID);
+        partition.shards.ask(old_shard, "dr " + old_record.title);
+        partition.shards.ask(new_shard, "xa " + to_string(ID) + " " + old_record.medium + " " + title);
+        if (old_record.rating != 0)
+        {
+            partition.shards.ask(new_shard, "mr " + to_string(ID) + " " + to_string(old_record.rating));
+        }
+        partition.ID_shards[ID] = new_shard;
+        cout << "Title for record " << ID << " changed to " << title << "\n";
+    }
+    for_each(partition.catalog.begin(), partition.catalog.end(), [ID, &title](pair<const string, Partition_members>& collection)
+        { auto member_iter = collection.second.find(ID); if (member_iter != collection.second.end()) { member_iter->second = title; }});
+    return false;
+}
+bool partition_add_record(partition_container& partition)
+{
+    string medium;
+    cin >> medium;
+    string title = title_read(cin);
+    int ID = partition.last_ID + 1, shard = partition.shards.shard_for_title(title);
+    Worker_reply reply = partition.shards.ask(shard, "xa " + to_string(ID) + " " + medium + " " + title);
+    if (reply.result == Result_class::OK)
+    {
+        partition.last_ID = ID;
+        partition.ID_shards[ID] = shard;
+    }
+    return forward_reply(reply);
+}
+bool partition_add_collection(partition_container& partition)
+{
+    string name;
+    cin >> name;
+    if (partition.catalog.count(name))
+    {
+        throw Error("Catalog already has a collection with this name!");
+    }
+    partition.catalog[name];
+    cout << "Collection " << name << " added\n";
+    return false;
+}
+bool partition_add_member(partition_container& partition)
+{
+    Partition_members* members = read_name_get_partition_members(partition);
+    if (!members)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    int ID = read_id_get_partition_ID(partition);
+    if (!ID)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    if (members->count(ID))
+    {
+        throw Error("Record is already a member in the collection!");
+    }
+    string title = fetch_record_lines(partition, vector<int>(1, ID)).at(ID).title;
+    (*members)[ID] = title;
+    count_partition_member(partition, ID);
+    cout << "Member " << ID << " " << title << " added\n";
+    return false;
+}
+bool partition_add_members(partition_container& partition)
+{
+    string name;
+    cin >> name;
+    auto collection_iter = partition.catalog.find(name);
+    if (collection_iter == partition.catalog.end())
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Partition_members* members = &collection_iter->second;
+    Member_filter filter = member_filter_read();
+    long long num_missing;
+    vector<int> IDs = partition_filter_IDs(partition, filter, num_missing);
+    // an ID named more than once is added the first time and already present after that
+    vector<int> new_IDs;
+    unique_copy(IDs.begin(), IDs.end(), back_inserter(new_IDs));
+    new_IDs.erase(remove_if(new_IDs.begin(), new_IDs.end(), [members](int ID) { return members->count(ID) > 0; }), new_IDs.end());
+    map<int, Record_line> record_lines = fetch_record_lines(partition, new_IDs);
+    for_each(new_IDs.begin(), new_IDs.end(), [&partition, members, &record_lines](int ID)
+        { (*members)[ID] = record_lines.at(ID).title; count_partition_member(partition, ID); });
+    cout << "Members added to " << name << ": " << new_IDs.size() << " added, "
+        << IDs.size() - new_IDs.size() << " already present, " << num_missing << " missing\n";
+    return false;
+}
+bool partition_delete_record(partition_container& partition)
+{
+    string title = title_read(cin);
+    int shard = partition.shards.shard_for_title(title);
+    Worker_reply found = partition.shards.ask(shard, "fr " + title);
+    if (found.result != Result_class::OK)
+    {
+        return report_error_no_clear(NO_TITLE_MSG);
+    }
+    int ID = reply_record_lines(found.output, 0).at(0).ID;
+    if (partition.membership_counts.count(ID))
+    {
+        throw ErrorNoClear("Cannot delete a record that is a member of a collection!");
+    }
+    partition.ID_shards.erase(ID);
+    return forward_reply(partition.shards.ask(shard, "dr " + title));
+}
+bool partition_delete_collection(partition_container& partition)
+{
+    string name;
+    cin >> name;
+    auto collection_iter = partition.catalog.find(name);
+    if (collection_iter == partition.catalog.end())
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    for_each(collection_iter->second.begin(), collection_iter->second.end(), [&partition](const Partition_members::value_type& member)
+        { uncount_partition_member(partition, member.first); });
+    partition.catalog.erase(collection_iter);
+    cout << "Collection " << name << " deleted\n";
+    return false;
+}
+bool partition_delete_member(partition_container& partition)
 {
-    clear_all(lib_cat);
+    Partition_members* members = read_name_get_partition_members(partition);
+    if (!members)
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    int ID = read_id_get_partition_ID(partition);
+    if (!ID)
+    {
+        return report_error(NO_ID_MSG);
+    }
+    auto member_iter = members->find(ID);
+    if (member_iter == members->end())
+    {
+        throw Error("Record is not a member in the collection!");
+    }
+    string title = member_iter->second;
+    members->erase(member_iter);
+    uncount_partition_member(partition, ID);
+    cout << "Member " << ID << " " << title << " deleted\n";
+    return false;
+}
+bool partition_delete_members(partition_container& partition)
+{
+    string name;
+    cin >> name;
+    auto collection_iter = partition.catalog.find(name);
+    if (collection_iter == partition.catalog.end())
+    {
+        return report_error(NO_NAME_MSG);
+    }
+    Partition_members* members = &collection_iter->second;
+    Member_filter filter = member_filter_read();
+    long long num_missing;
+    vector<int> IDs = partition_filter_IDs(partition, filter, num_missing);
+    size_t num_deleted = 0;
+    for_each(IDs.begin(), IDs.end(), [&partition, members, &num_deleted](int ID)
+        { if (members->erase(ID)) { uncount_partition_member(partition, ID); ++num_deleted; } });
+    cout << "Members deleted from " << name << ": " << num_deleted << " deleted, "
+        << IDs.size() - num_deleted << " not present, " << num_missing << " missing\n";
+    return false;
+}
+bool partition_clear_library(partition_container& partition)
+{
+    if (!partition.membership_counts.empty())
+    {
+        throw Error("Cannot clear all records unless all collections are empty!");
+    }
+    partition.shards.ask_all("cL");
+    partition.ID_shards.clear();
+    partition.last_ID = 0;
+    cout << "All records deleted\n";
+    return false;
+}
+bool partition_clear_catalog(partition_container& partition)
+{
+    partition.catalog.clear();
+    partition.membership_counts.clear();
+    cout << "All collections deleted\n";
+    return false;
+}
+bool partition_clear_all(partition_container& partition)
+{
+    partition.shards.ask_all("cA");
+    partition.catalog.clear();
+    partition.membership_counts.clear();
+    partition.ID_shards.clear();
+    partition.last_ID = 0;
+    cout << "All data deleted\n";
+    return false;
+}
+bool partition_save_all(partition_container& partition)
+{
+    string filename;
+    cin >> filename;
+    ofstream file(filename.c_str());
+    if (!file)
+    {
+        throw Error(FILE_OPEN_FAIL_MSG);
+    }
+    // the same file save_all writes: the records in title order, then each collection's member titles in order
+    vector<Record_line> library = partition_library_lines(partition);
+    file << library.size() << "\n";
+    for_each(library.begin(), library.end(), [&file](const Record_line& line)
+        { file << line.ID << " " << line.medium << " " << line.rating << " " << line.title << "\n"; });
+    file << partition.catalog.size() << "\n";
+    for_each(partition.catalog.begin(), partition.catalog.end(), [&file](const pair<const string, Partition_members>& collection)
+    {
+        vector<string> titles;
+        for_each(collection.second.begin(), collection.second.end(), [&titles](const Partition_members::value_type& member)
+            { titles.push_back(member.second); });
+        sort(titles.begin(), titles.end());
+        file << collection.first << " " << titles.size() << "\n";
+        for_each(titles.begin(), titles.end(), [&file](const string& title) { file << title << "\n"; });
+    });
+    file.close();
+    cout << "Data saved\n";
+    return false;
+}
+bool partition_restore_all(partition_container& partition)
+{
+    string filename;
+    cin >> filename;
+    restore_partition_data(partition, filename);
+    cout << "Data loaded\n";
+    return false;
+}
+bool partition_quit(partition_container& partition)
+{
+    partition.shards.quit();
+    partition.catalog.clear();
+    partition.membership_counts.clear();
+    partition.ID_shards.clear();
+    cout << "All data deleted\n";
     cout << "Done\n";
     return true;
-}
\ No newline at end of file
+}
+bool partition_unsupported(partition_container& partition)
+{
+    throw Error("Command is not available in a partitioned library!");
+}
+
+/* replica lib cat functions impl */
+
+// Loads the library saved in a snapshot file and applies the changes the feed has after the snapshot was saved.
+// Throw Error exception if the snapshot cannot be loaded or the feed has no record of it.
+void start_replica(replica_container& replica, const string& snapshot_filename)
+{
+    unsigned long long checksum = file_checksum(snapshot_filename);
+    restore_data(replica.lib_cat, snapshot_filename);
+    // the changes before the snapshot are already in it; the same library may have been saved more than once,
+    // but starting after any of the saves gives the same result
+    while (true)
+    {
+        vector<Feed_change> changes = replica.feed.take_changes(REPLICA_START_WAIT_MS);
+        if (changes.empty())
+        {
+            throw Error("The change feed has no record of that snapshot!");
+        }
+        auto snapshot_it = find_if(changes.begin(), changes.end(), [checksum](const Feed_change& change)
+            { return change.op == Feed_op::SNAPSHOT && change.checksum == checksum; });
+        if (snapshot_it != changes.end())
+        {
+            apply_changes(replica, next(snapshot_it), changes.end());
+            return;
+        }
+    }
+}
+
+// Applies the changes of the commands committed to the feed since the last time.
+// Throw Error exception if the replica has stopped following the feed, now or before.
+void apply_feed(replica_container& replica)
+{
+    if (replica.failure.empty())
+    {
+        try
+        {
+            vector<Feed_change> changes = replica.feed.take_changes();
+            apply_changes(replica, changes.begin(), changes.end());
+        } catch (Error& e)
+        {
+            replica.failure = string(REPLICA_STOPPED_MSG) + e.msg;
+        }
+    }
+    if (!replica.failure.empty())
+    {
+        throw Error(replica.failure.c_str());
+    }
+}
+// Applies changes to the library; if one does not fit, the replica stops following the feed for good
+void apply_changes(replica_container& replica, vector<Feed_change>::const_iterator first, vector<Feed_change>::const_iterator last)
+{
+    try
+    {
+        for_each(first, last, [&replica](const Feed_change& change) { apply_change(replica.lib_cat, change); });
+    } catch (Error& e)
+    {
+        // the changes after the one that failed are lost with it, so the library cannot catch up with the primary's
+        replica.failure = string(REPLICA_STOPPED_MSG) + e.msg;
+    }
+}
+
+// Applies one change to the library. Throw Error exception if it does not fit the library.
+void apply_change(data_container& lib_cat, const Feed_change& change)
+{
+    const char * const MISMATCH_MSG = "The change feed does not match the library!";
+    Record *record_ptr = nullptr;
+    Collection *collection_ptr = nullptr;
+    // look up what the change refers to first, so that a change that does not fit changes nothing
+    switch (change.op)
+    {
+        case Feed_op::DELETE_RECORD:
+        case Feed_op::MODIFY_RATING:
+        case Feed_op::MODIFY_TITLE:
+            record_ptr = lib_cat.library.get<BY_ID>().find(change.ID);
+            if (!record_ptr)
+            {
+                throw Error(MISMATCH_MSG);
+            }
+            break;
+        case Feed_op::ADD_MEMBER:
+        case Feed_op::DELETE_MEMBER:
+            record_ptr = lib_cat.library.get<BY_ID>().find(change.ID);
+            collection_ptr = lib_cat.catalog.find(change.name);
+            if (!record_ptr || !collection_ptr)
+            {
+                throw Error(MISMATCH_MSG);
+            }
+            break;
+        case Feed_op::DELETE_COLLECTION:
+            if (!lib_cat.catalog.find(change.name))
+            {
+                throw Error(MISMATCH_MSG);
+            }
+            break;
+        default:
+            break;
+    }
+    switch (change.op)
+    {
+        case Feed_op::ADD_RECORD:
+        {
+            Record *record = new Record(change.ID, change.name, change.title);
+            if (change.rating != 0)
+            {
+                try
+                {
+                    record->set_rating(change.rating);
+                } catch (...)
+                {
+                    delete record;
+                    throw;
+                }
+            }
+            insert_record(lib_cat, record);
+            break;
+        }
+        case Feed_op::DELETE_RECORD:
+            remove_record(lib_cat, record_ptr);
+            delete record_ptr;
+            break;
+        case Feed_op::MODIFY_RATING:
+            change_rating(lib_cat, record_ptr, change.rating);
+            break;
+        case Feed_op::MODIFY_TITLE:
+            change_title(lib_cat, record_ptr, change.title);
+            break;
+        case Feed_op::ADD_COLLECTION:
+            insert_collection(lib_cat, Collection(change.name));
+            break;
+        case Feed_op::DELETE_COLLECTION:
+            lib_cat.catalog.erase(change.name);
+            break;
+        case Feed_op::ADD_MEMBER:
+            lib_cat.catalog.add_member(*collection_ptr, record_ptr);
+            break;
+        case Feed_op::DELETE_MEMBER:
+            lib_cat.catalog.remove_member(*collection_ptr, record_ptr);
+            break;
+        case Feed_op::CLEAR_LIBRARY:
+            Record::reset_ID_counter();
+            clear_library_data(lib_cat);
+            break;
+        case Feed_op::CLEAR_CATALOG:
+            lib_cat.catalog.clear();
+            break;
+        case Feed_op::CLEAR_ALL:
+            clear_all_data(lib_cat);
+            break;
+        case Feed_op::SNAPSHOT:
+        case Feed_op::COMMIT:
+            break;
+    }
+}
+
+// Brings the replica up to date with the feed and then runs a read-only command on its library
+template<bool (*Command)(data_container&)>
+bool replica_command(replica_container& replica)
+{
+    apply_feed(replica);
+    return Command(replica.lib_cat);
+}
+
+bool replica_print_feed(replica_container& replica)
+{
+    apply_feed(replica);
+    cout << "Replica: " << replica.feed.get_num_commits() << " commands, " << replica.feed.get_num_changes() << " changes read from the feed, "
+        << replica.feed.get_num_waiting() << " bytes waiting\n";
+    return false;
+}
+
+// Reports that a command would change the library, which only the primary may do
+bool replica_read_only(replica_container& replica)
+{
+    if (!replica.failure.empty())
+    {
+        throw Error(replica.failure.c_str());
+    }
+    throw Error("Command is not available in a read-only replica!");
+}
+// Quits without bringing the replica up to date, since nothing more is shown from it
+bool replica_quit(replica_container& replica)
+{
+    return quit(replica.lib_cat);
+}
@@ -0,0 +1,331 @@
+/* Replays a trace recorded with p3exe -capture against a fresh p3exe process,
+ * either at the pacing of the original arrivals or as fast as possible,
+ * and reports the distribution of command latencies and any commands whose output
+ * differs from the captured output.
+ *
+ * Usage: p3replay [-fast] trace_file [program]
+ * The program defaults to ./p3exe. The exit status is 0 if every output matched,
+ * 1 if any diverged, and 2 if the replay could not be completed.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cctype>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Capture.h"
+#include "Utility.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+const string PROMPT = "\nEnter command: ";
+// how long to wait for the program to respond before giving up
+const int RESPONSE_TIMEOUT_MS = 10000;
+// how many divergent commands are described in the report
+const size_t MAX_DIVERGENCES_SHOWN = 5;
+
+// a running copy of the program being driven, connected through pipes
+struct Child_process {
+    pid_t pid = -1;
+    int to_child = -1;
+    int from_child = -1;
+    // output read from the child that has not been claimed by a command yet
+    string unclaimed;
+    bool at_eof = false;
+};
+
+// the outcome of replaying one command
+struct Replay_result {
+    string command;
+    long long latency_us;
+    long long captured_exec_us;
+};
+
+// Starts the program with its standard input and output connected to pipes
+Child_process start_child(const string& program);
+// Writes the input to the child while reading its output, until the child has printed a prompt
+// (or reached end of file if wait_for_eof is true) and returns the output before the prompt
+string exchange(Child_process& child, const string& input, bool wait_for_eof);
+// Closes the pipes to the child and waits for it to exit
+void stop_child(Child_process& child);
+
+// Returns the command name at the start of some command input
+string command_name(const string& input);
+// Returns the given percentile of a sorted list of latencies
+long long percentile(const vector<long long>& sorted, double fraction);
+// Prints the mean, percentiles and maximum of a list of latencies
+void print_distribution(const string& label, vector<long long> latencies);
+// Returns a printable form of some output for describing a divergence
+string printable(const string& text);
+
+int main(int argc, char* argv[])
+{
+    bool fast = false;
+    vector<string> arguments(argv + 1, argv + argc);
+    if (!arguments.empty() && arguments.front() == "-fast")
+    {
+        fast = true;
+        arguments.erase(arguments.begin());
+    }
+    if (arguments.empty() || arguments.size() > 2)
+    {
+        cerr << "Usage: " << argv[0] << " [-fast] trace_file [program]\n";
+        return 2;
+    }
+    string program = arguments.size() == 2 ? arguments[1] : "./p3exe";
+
+    signal(SIGPIPE, SIG_IGN);
+    vector<Replay_result> results;
+    vector<size_t> divergent;
+    Clock::time_point replay_start;
+    try
+    {
+        ifstream trace(arguments[0].c_str(), ios::binary);
+        if (!trace)
+        {
+            throw Error("Could not open trace file!");
+        }
+        read_trace_header(trace);
+        Trace_entry current, next;
+        bool have_current = read_trace_entry(trace, current);
+        bool have_next = have_current && read_trace_entry(trace, next);
+
+        Child_process child = start_child(program);
+        // the initial prompt is not part of any command
+        exchange(child, "", false);
+        replay_start = Clock::now();
+        // how much of the current command's input was sent early as lookahead
+        size_t already_sent = 0;
+        vector<string> shown;
+        while (have_current)
+        {
+            if (!fast)
+            {
+                this_thread::sleep_until(replay_start + chrono::microseconds(current.arrival_us));
+            }
+            string input = current.input.substr(min(already_sent, current.input.size()));
+            already_sent = 0;
+            if (have_next && current.lookahead > 0)
+            {
+                already_sent = min(current.lookahead, next.input.size());
+                input += next.input.substr(0, already_sent);
+            }
+            Clock::time_point sent = Clock::now();
+            string output = exchange(child, input, current.result == Result_class::QUIT);
+            long long latency = chrono::duration_cast<chrono::microseconds>(Clock::now() - sent).count();
+            results.push_back({command_name(current.input), latency, current.exec_us});
+            if (output != current.output)
+            {
+                divergent.push_back(results.size());
+                if (shown.size() < MAX_DIVERGENCES_SHOWN)
+                {
+                    shown.push_back("  command " + to_string(results.size()) + " (" + results.back().command + "): expected \""
+                        + printable(current.output) + "\", got \"" + printable(output) + "\"");
+                }
+            }
+            swap(current, next);
+            have_current = have_next;
+            have_next = have_current && read_trace_entry(trace, next);
+        }
+        stop_child(child);
+
+        long long elapsed_ms = chrono::duration_cast<chrono::milliseconds>(Clock::now() - replay_start).count();
+        cout << "Replayed " << results.size() << " commands in " << elapsed_ms << " ms "
+            << (fast ? "as fast as possible" : "at the original pacing") << "\n";
+        vector<long long> latencies, exec_times;
+        map<string, vector<long long>> latencies_by_command;
+        for (auto& result : results)
+        {
+            latencies.push_back(result.latency_us);
+            exec_times.push_back(result.captured_exec_us);
+            latencies_by_command[result.command].push_back(result.latency_us);
+        }
+        print_distribution("Replay latency", latencies);
+        print_distribution("Captured execution time", exec_times);
+        for (auto& command_latencies : latencies_by_command)
+        {
+            print_distribution("  " + command_latencies.first, command_latencies.second);
+        }
+        cout << "Divergent outputs: " << divergent.size() << "\n";
+        for (auto& description : shown)
+        {
+            cout << description << "\n";
+        }
+    } catch (Error& e)
+    {
+        cerr << e.msg << "\n";
+        return 2;
+    }
+    return divergent.empty() ? 0 : 1;
+}
+
+// Starts the program with its standard input and output connected to pipes
+Child_process start_child(const string& program)
+{
+    int input_pipe[2], output_pipe[2];
+    if (pipe(input_pipe) != 0 || pipe(output_pipe) != 0)
+    {
+        throw Error("Could not create pipes!");
+    }
+    Child_process child;
+    child.pid = fork();
+    if (child.pid < 0)
+    {
+        throw Error("Could not start program!");
+    }
+    if (child.pid == 0)
+    {
+        signal(SIGPIPE, SIG_DFL);
+        dup2(input_pipe[0], STDIN_FILENO);
+        dup2(output_pipe[1], STDOUT_FILENO);
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+        execl(program.c_str(), program.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(input_pipe[0]);
+    close(output_pipe[1]);
+    child.to_child = input_pipe[1];
+    child.from_child = output_pipe[0];
+    return child;
+}
+
+// Writes the input to the child while reading its output, until the child has printed a prompt
+// (or reached end of file if wait_for_eof is true) and returns the output before the prompt
+string exchange(Child_process& child, const string& input, bool wait_for_eof)
+{
+    size_t written = 0;
+    while (true)
+    {
+        if (written == input.size() && !wait_for_eof)
+        {
+            size_t prompt_pos = child.unclaimed.find(PROMPT);
+            if (prompt_pos != string::npos)
+            {
+                string output = child.unclaimed.substr(0, prompt_pos);
+                child.unclaimed.erase(0, prompt_pos + PROMPT.size());
+                return output;
+            }
+        }
+        if (child.at_eof)
+        {
+            if (written < input.size() || !wait_for_eof)
+            {
+                throw Error("Program ended unexpectedly!");
+            }
+            string output;
+            output.swap(child.unclaimed);
+            return output;
+        }
+        pollfd fds[2] = {{child.from_child, POLLIN, 0}, {child.to_child, POLLOUT, 0}};
+        int num_fds = written < input.size() ? 2 : 1;
+        int ready = poll(fds, num_fds, RESPONSE_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            throw Error("Program stopped responding!");
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            char buffer[65536];
+            ssize_t num_read = read(child.from_child, buffer, sizeof(buffer));
+            if (num_read <= 0)
+            {
+                child.at_eof = true;
+            } else
+            {
+                child.unclaimed.append(buffer, num_read);
+            }
+        }
+        if (num_fds == 2 && (fds[1].revents & (POLLOUT | POLLERR | POLLHUP)))
+        {
+            ssize_t num_written = write(child.to_child, input.data() + written, input.size() - written);
+            if (num_written < 0)
+            {
+                throw Error("Could not write to program!");
+            }
+            written += num_written;
+        }
+    }
+}
+
+// Closes the pipes to the child and waits for it to exit
+void stop_child(Child_process& child)
+{
+    close(child.to_child);
+    close(child.from_child);
+    int status;
+    waitpid(child.pid, &status, 0);
+}
+
+// Returns the command name at the start of some command input
+string command_name(const string& input)
+{
+    string name;
+    for (char c : input)
+    {
+        if (!isspace(c))
+        {
+            name.push_back(c);
+        }
+        if (name.size() == 2)
+        {
+            break;
+        }
+    }
+    return name.empty() ? "(none)" : name;
+}
+
+// Returns the given percentile of a sorted list of latencies
+long long percentile(const vector<long long>& sorted, double fraction)
+{
+    size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+// Prints the mean, percentiles and maximum of a list of latencies
+void print_distribution(const string& label, vector<long long> latencies)
+{
+    if (latencies.empty())
+    {
+        return;
+    }
+    sort(latencies.begin(), latencies.end());
+    long long total = 0;
+    for_each(latencies.begin(), latencies.end(), [&total](long long latency) { total += latency; });
+    cout << label << " (us, " << latencies.size() << " commands): mean " << total / static_cast<long long>(latencies.size())
+        << ", p50 " << percentile(latencies, 0.5) << ", p90 " << percentile(latencies, 0.9)
+        << ", p99 " << percentile(latencies, 0.99) << ", max " << latencies.back() << "\n";
+}
+
+// Returns a printable form of some output for describing a divergence
+string printable(const string& text)
+{
+    const size_t max_length = 60;
+    string result;
+    for (char c : text.substr(0, max_length))
+    {
+        result += c == '\n' ? string("\\n") : string(1, c);
+    }
+    return text.size() > max_length ? result + "..." : result;
+}
@@ -0,0 +1,186 @@
+#!/bin/bash
+# Runs the tests: each name_in.txt is fed to p3exe and its output compared with name_out.txt,
+# and the checks below run the program in the modes the expected outputs cannot cover.
+# Run from the source directory after make, or with make test.
+
+cd "$(dirname "$0")"
+failures=0
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"; rm -f savefile1.txt exportfile.cols' EXIT
+
+fail()
+{
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+# Byte counts depend on the compiler and standard library, so the expected outputs
+# hold # in their place; the counts are checked by check_memory_invariants instead
+normalize()
+{
+    sed -E -e 's/: [0-9]+ bytes live, [0-9]+ bytes peak, [0-9]+ allocations$/: # bytes live, # bytes peak, # allocations/' \
+        -e 's/made [0-9]+ heap allocations$/made # heap allocations/'
+}
+
+# Check the heap allocations that ph reports in an output against the bounds in a file, one per line
+# in the same order, each a number and then what the command was; lines starting with # are comments
+check_allocation_bounds()
+{
+    grep -o 'made [0-9]* heap allocations$' "$2" | awk '{ print $2 }' |
+        paste - <(grep -v '^#' "$3" | awk '{ print $1 }') |
+        awk -v name="$1" '
+            $2 == "" || $1 == "" { print "FAIL: " name ": ph reports and bounds differ in number"; failed = 1; exit }
+            $1 > $2 { print "FAIL: " name ": command " NR " made " $1 " heap allocations, more than " $2; failed = 1 }
+            END { exit failed }'
+}
+
+# Check every memory report in an output for consistency: no category has more live bytes than
+# its peak, the categories add up to the totals, and a library with no records holds no record memory
+check_memory_invariants()
+{
+    awk -v name="$1" '
+        function report(message) { print "FAIL: " name ": " message " in memory report " reports; failed = 1 }
+        /Records: [0-9]+$/ { records = $NF }
+        /Tracked memory: / {
+            ++reports; in_report = 1
+            split($0, parts, ": "); split(parts[2], total, /[ ,]+/)
+            sum_live = sum_allocations = 0; max_peak = 0; sum_peak = 0
+            if (total[1] > total[4]) report("total live bytes above peak")
+            next
+        }
+        in_report && /^  [a-z ]+: [0-9]+ bytes live/ {
+            split($0, parts, ": "); split(parts[2], usage, /[ ,]+/); sub(/^ +/, "", parts[1])
+            if (usage[1] > usage[4]) report(parts[1] " live bytes above peak")
+            sum_live += usage[1]; sum_allocations += usage[7]; sum_peak += usage[4]
+            if (usage[4] > max_peak) max_peak = usage[4]
+            if (records == 0 && (parts[1] == "records" || parts[1] == "title storage") && usage[1] != 0)
+                report(parts[1] " live with no records")
+            next
+        }
+        in_report {
+            in_report = 0
+            if (sum_live != total[1]) report("category live bytes do not add up to the total")
+            if (sum_allocations != total[7]) report("category allocations do not add up to the total")
+            if (total[4] < max_peak || total[4] > sum_peak) report("total peak out of range of the category peaks")
+        }
+        END { exit failed }'
+}
+
+# the expected outputs
+for input in *_in.txt
+do
+    name=${input%_in.txt}
+    [ -f "${name}_out.txt" ] || continue
+    ./p3exe < "$input" > "$scratch/$name.out" 2>&1
+    normalize < "$scratch/$name.out" | diff -q - "${name}_out.txt" > /dev/null || fail "$name"
+    check_memory_invariants "$name" < "$scratch/$name.out" || failures=$((failures + 1))
+    if [ -f "${name}_bounds.txt" ]
+    then
+        check_allocation_bounds "$name" "$scratch/$name.out" "${name}_bounds.txt" || failures=$((failures + 1))
+    fi
+done
+
+# with long titles in the title store the expected outputs must not change, apart from the store's own
+# lines in pa, whether the budget holds no title or only a few, and what is resident must stay within the budget
+for budget in 64 400
+do
+    for input in *_in.txt
+    do
+        name=${input%_in.txt}
+        [ -f "${name}_out.txt" ] || continue
+        ./p3exe -title-budget $budget < "$input" > "$scratch/$name.out" 2>&1
+        grep -v '^Title store: \|budget bytes resident' "$scratch/$name.out" | normalize | diff -q - "${name}_out.txt" > /dev/null ||
+            fail "$name -title-budget $budget"
+        check_memory_invariants "$name -title-budget $budget" < "$scratch/$name.out" || failures=$((failures + 1))
+        awk -v name="$name -title-budget $budget" '
+            / budget bytes resident/ && $1 > $3 { print "FAIL: " name ": " $1 " bytes resident, over the budget"; failed = 1 }
+            END { exit failed }' "$scratch/$name.out" || failures=$((failures + 1))
+    done
+done
+
+# a record restored far below the first ID goes to the ID table's overflow, and must still be found
+# once the IDs restored after it grow the table's window down over it
+awk 'BEGIN { print 2000; print "2000 DVD 0 T02000"; print "1 DVD 0 T00001"
+    for (i = 1999; i >= 2; i--) printf "%d VHS 3 T%05d\n", i, i; print 0 }' > "$scratch/out_of_order.txt"
+printf 'rA %s\npr 1\ndr T00001\npr 1\nqq\n' "$scratch/out_of_order.txt" | ./p3exe > "$scratch/out_of_order.out" 2>&1
+printf '\nEnter command: Data loaded\n\nEnter command: 1: DVD u T00001\n\nEnter command: Record 1 T00001 deleted\n\n%s\n\n%s\n%s\n' \
+    'Enter command: No record with that ID!' 'Enter command: All data deleted' 'Done' | diff -q - "$scratch/out_of_order.out" > /dev/null ||
+    fail "restore with IDs out of order"
+
+# a partitioned library must answer as one held in a single process, whatever the number of shards,
+# and save the same file
+./p3exe < partition_in.txt > /dev/null 2>&1 && cp savefile1.txt "$scratch/partition_save.txt"
+for shards in 1 2 3 5
+do
+    name="partition -shards $shards"
+    ./p3exe -shards $shards < partition_in.txt > "$scratch/partition_$shards.out" 2>&1
+    normalize < "$scratch/partition_$shards.out" | diff -q - partition_out.txt > /dev/null || fail "$name"
+    check_memory_invariants "$name" < "$scratch/partition_$shards.out" || failures=$((failures + 1))
+    cmp -s savefile1.txt "$scratch/partition_save.txt" || fail "$name: saved file differs"
+done
+
+# a replica following a primary's feed from a snapshot must show the library the primary ends with
+cat > "$scratch/primary_in.txt" <<END
+ar DVD Apocalypse Now
+ar VHS Zulu Dawn
+ac classics
+am classics 1
+sA $scratch/snapshot.txt
+ar DVD the matrix
+ar DVD 2001 A Space Odyssey
+mr 3 4
+mt 2 Zulu
+ac favourites
+am favourites 2
+am favourites 3
+dm classics 1
+am classics 4
+dr Apocalypse Now
+ar VHS Ran
+mr 5 2
+pL
+pC
+lr
+qq
+END
+./p3exe -feed "$scratch/feed" < "$scratch/primary_in.txt" > "$scratch/primary.out" 2>&1
+printf 'pL\npC\nlr\nqq\n' | ./p3exe -replica "$scratch/snapshot.txt" "$scratch/feed" > "$scratch/replica.out" 2>&1
+grep -q "Library contains 4 records:$" "$scratch/replica.out" &&
+    tail -n "$(wc -l < "$scratch/replica.out")" "$scratch/primary.out" | diff -q - "$scratch/replica.out" > /dev/null ||
+    fail "replica"
+
+# once a change from the feed does not fit, the replica's library has left the primary's behind for good,
+# so every later command reports it; here the feed goes on to delete record 5, then add a collection that would fit
+printf 'ar DVD Alpha\nsA %s\nqq\n' "$scratch/snapshot.txt" | ./p3exe -feed "$scratch/feed" > /dev/null 2>&1
+printf '\x02\x02\x05\x01\x0d\x06\x05\x04late\x01\x0d' >> "$scratch/feed"
+printf 'pL\npC\npc late\nqq\n' | ./p3exe -replica "$scratch/snapshot.txt" "$scratch/feed" > "$scratch/replica.out" 2>&1
+[ "$(grep -c "^Enter command: The replica has stopped following the change feed: " "$scratch/replica.out")" -eq 3 ] ||
+    fail "replica after a change that does not fit"
+
+# a columnar export must hold what a save of the same library does: p3cols decodes it into the save format.
+# There are enough records and members to fill more than one row group, and long titles go to the title store.
+awk 'BEGIN {
+    split("DVD VHS Bluray", mediums, " ")
+    for (i = 1; i <= 70000; i++)
+    {
+        print "ar " mediums[i % 3 + 1] " Title " (i * 7919) % 70001 " of the export"
+        if (i % 7 == 0) print "mr " i " " (i % 5 + 1)
+    }
+    print "ac all"; print "aM all range 1 70000"
+    print "ac few"; print "aM few ids 3 5 7 69999"
+    print "ac empty"
+}' > "$scratch/export_in.txt"
+printf 'sA %s\neA %s\nqq\n' "$scratch/export_save.txt" "$scratch/export.cols" >> "$scratch/export_in.txt"
+for options in "" "-title-budget 4096"
+do
+    ./p3exe $options < "$scratch/export_in.txt" > /dev/null 2>&1
+    ./p3cols "$scratch/export.cols" | cmp -s - "$scratch/export_save.txt" || fail "export round trip $options"
+done
+
+if [ $failures -eq 0 ]
+then
+    echo "All tests passed"
+else
+    echo "$failures failed"
+fi
+[ $failures -eq 0 ]